@@ -0,0 +1,59 @@
+// Counts heap allocations paid per inbound line on the PRIVMSG path:
+// the retrieved line is parsed into a Message and relayed via rplfuncs.
+
+#include <cstdio>
+#include <string>
+
+#include "alloccounter.hpp"
+#include "message.hpp"
+#include "rplfuncs.hpp"
+
+namespace
+{
+template <typename F>
+void measure(const char* name, F&& f)
+{
+    constexpr int kRounds = 100000;
+    f();    // warm up any lazily allocated statics
+
+    auto allocs = npcp::bench::allocations(), bytes = npcp::bench::allocated_bytes();
+    for (int i = 0; i < kRounds; ++i) f();
+    allocs = npcp::bench::allocations() - allocs;
+    bytes = npcp::bench::allocated_bytes() - bytes;
+
+    std::printf("%-28s %8.2f allocs/op %10.1f bytes/op\n", name,
+        static_cast<double>(allocs) / kRounds,
+        static_cast<double>(bytes) / kRounds);
+}
+} // namespace
+
+int main()
+{
+    using namespace npcp;
+
+    const std::string nick = "alice", user = "alice_user";
+    const std::string line = "PRIVMSG #general :hello there, this is a fairly ordinary chat line\r\n";
+
+    measure("parse PRIVMSG", [&] {
+        Message msg(line);
+    });
+
+    measure("parse + relay PRIVMSG", [&] {
+        Message msg(line);
+        const auto &args = msg.args();
+        auto rpl = reply::rpl_privmsg_or_notice(nick, user, true, args[0], args[1]);
+    });
+
+    measure("parse + relay short PRIVMSG", [&] {
+        Message msg("PRIVMSG bob :hi\r\n");
+        const auto &args = msg.args();
+        auto rpl = reply::rpl_privmsg_or_notice(nick, user, true, args[0], args[1]);
+    });
+
+    measure("parse PING", [&] {
+        Message msg("PING jusot.com\r\n");
+        auto rpl = reply::rpl_pong("jusot.com");
+    });
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <new>
+#include <atomic>
+#include <cstdlib>
+
+#include "alloccounter.hpp"
+
+namespace
+{
+std::atomic<std::size_t> g_allocs{0};
+std::atomic<std::size_t> g_bytes{0};
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace npcp
+{
+namespace bench
+{
+std::size_t allocations()
+{
+    return g_allocs.load(std::memory_order_relaxed);
+}
+
+std::size_t allocated_bytes()
+{
+    return g_bytes.load(std::memory_order_relaxed);
+}
+
+} // namespace bench
+} // namespace npcp
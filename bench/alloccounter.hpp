@@ -0,0 +1,18 @@
+#ifndef NPCP_BENCH_ALLOCCOUNTER_HPP
+#define NPCP_BENCH_ALLOCCOUNTER_HPP
+
+#include <cstddef>
+
+namespace npcp
+{
+namespace bench
+{
+// Linking alloccounter.cpp replaces the global operator new, after which
+// these count every heap allocation the program makes.
+std::size_t allocations();
+std::size_t allocated_bytes();
+
+} // namespace bench
+} // namespace npcp
+
+#endif // NPCP_BENCH_ALLOCCOUNTER_HPP
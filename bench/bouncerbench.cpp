@@ -0,0 +1,288 @@
+// npcp_bouncerbench: what a bouncer reconnect into many channels costs.
+//
+// Fills --channels channels with --users quiet members, then has one client
+// connect, register and join all of those channels, and times it from the
+// JOINs going out to the last 366 coming back. It does that --rounds times
+// with one JOIN per channel and --rounds times with the channels packed into
+// as few JOINs as the server's 005 TARGMAX and the 512 byte line allow, so
+// run the server with --isupport 1 to get the second set.
+//
+//   npcp_bouncerbench [--host H] [--port P] [--channels N] [--users N] [--rounds N]
+
+#include <memory>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "ircclient.hpp"
+
+namespace
+{
+using npcp::bench::IrcClient;
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int port = 7776;
+    int channels = 200;
+    int users = 10;
+    int rounds = 20;
+};
+
+std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string channel(int c)
+{
+    return "#bnc" + std::to_string(c);
+}
+
+// JOIN lines for every channel, at most per_line channels each (0 for no
+// limit) and never over 512 bytes
+std::vector<std::string> join_lines(int channels, int per_line)
+{
+    std::vector<std::string> lines;
+    std::string line;
+    int in_line = 0;
+    for (int c = 0; c < channels; ++c)
+    {
+        const auto name = channel(c);
+        if (!line.empty() && ((per_line && in_line == per_line) || line.size() + 1 + name.size() + 2 > 512))
+        {
+            lines.push_back(line + "\r\n");
+            line.clear();
+            in_line = 0;
+        }
+        line += line.empty() ? "JOIN " + name : "," + name;
+        ++in_line;
+    }
+    if (!line.empty()) lines.push_back(line + "\r\n");
+    return lines;
+}
+
+// the JOIN limit of a 005 line, 0 for none and -1 if it has no TARGMAX JOIN
+int targmax_join(std::string_view line)
+{
+    auto pos = line.find("TARGMAX=");
+    if (pos == std::string_view::npos) return -1;
+    auto targmax = line.substr(pos + 8, line.find(' ', pos) - pos - 8);
+    pos = targmax.find("JOIN:");
+    if (pos == std::string_view::npos) return -1;
+    return std::atoi(std::string(targmax.substr(pos + 5)).c_str());
+}
+
+class Bench
+{
+  public:
+    explicit Bench(const Options& options)
+      : options_(options),
+        epoll_(::epoll_create1(EPOLL_CLOEXEC))
+    {
+    }
+
+    ~Bench()
+    {
+        ::close(epoll_);
+    }
+
+    // false if the members can't be set up
+    bool populate();
+
+    // one reconnect joining every channel, per_line as in join_lines; the
+    // nanoseconds from the first JOIN to the last 366, -1 on failure
+    std::int64_t reconnect(int per_line);
+
+    // what the last reconnect learned from 005, -1 before any
+    int targmax() const { return targmax_; }
+    std::size_t last_lines() const { return last_lines_; }
+
+  private:
+    struct Peer
+    {
+        std::unique_ptr<IrcClient> client;
+        bool registered = false;        // through the end of MOTD
+        int joined = 0;                 // 366s seen
+        bool closed = false;
+    };
+
+    // the peer is added at id, which is its index in peers_
+    bool connect_peer(std::size_t id, const std::string& nick);
+    void poll(int timeout_ms);
+    // poll until done() or the deadline, false on the deadline
+    template <typename F>
+    bool wait(F&& done, std::int64_t timeout_ns = 10000000000);
+
+    const Options& options_;
+    int epoll_;
+    std::vector<Peer> peers_;           // the members, then the bouncer
+    int targmax_ = -1;
+    std::size_t last_lines_ = 0;
+};
+
+bool Bench::connect_peer(std::size_t id, const std::string &nick)
+{
+    int fd = npcp::bench::connect_to(options_.host, options_.port);
+    if (fd < 0) return false;
+
+    if (peers_.size() <= id) peers_.resize(id + 1);
+    peers_[id] = Peer();
+    peers_[id].client = std::make_unique<IrcClient>(fd);
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u64 = id;
+    ::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev);
+    peers_[id].client->queue("NICK " + nick + "\r\nUSER " + nick + " * * :npcp bouncerbench\r\n");
+    peers_[id].client->flush();
+    return true;
+}
+
+void Bench::poll(int timeout_ms)
+{
+    epoll_event events[256];
+    int n = ::epoll_wait(epoll_, events, 256, timeout_ms);
+    for (int i = 0; i < n; ++i)
+    {
+        auto &peer = peers_[events[i].data.u64];
+        if (peer.closed || !peer.client) continue;
+        if (events[i].events & EPOLLOUT) peer.client->flush();
+        const bool open = peer.client->read_lines([&] (std::string_view line) {
+            if (line.find(" 005 ") != std::string_view::npos)
+                targmax_ = std::max(targmax_, targmax_join(line));
+            else if (line.find(" 376 ") != std::string_view::npos || line.find(" 422 ") != std::string_view::npos)
+                peer.registered = true;
+            else if (line.find(" 366 ") != std::string_view::npos)
+                ++peer.joined;
+        });
+        if (!open)
+        {
+            peer.closed = true;
+            peer.client->close();
+        }
+    }
+}
+
+template <typename F>
+bool Bench::wait(F&& done, std::int64_t timeout_ns)
+{
+    for (auto deadline = now_ns() + timeout_ns; !done(); poll(10))
+        if (now_ns() > deadline) return false;
+    return true;
+}
+
+bool Bench::populate()
+{
+    for (int i = 0; i < options_.users; ++i)
+        if (!connect_peer(i, "member" + std::to_string(i))) return false;
+    if (!wait([&] { return std::all_of(peers_.begin(), peers_.end(), [] (const Peer& p) { return p.registered; }); }))
+        return false;
+
+    // the members join one channel per line so this works against any server
+    for (auto &peer : peers_)
+    {
+        for (const auto &line : join_lines(options_.channels, 1)) peer.client->queue(line);
+        peer.client->flush();
+    }
+    return wait([&] {
+        return std::all_of(peers_.begin(), peers_.end(), [&] (const Peer& p) { return p.joined == options_.channels; });
+    }, 60000000000);
+}
+
+std::int64_t Bench::reconnect(int per_line)
+{
+    const std::size_t id = options_.users;
+    if (!connect_peer(id, "bouncer")) return -1;
+    targmax_ = -1;
+    if (!wait([&] { return peers_[id].registered; })) return -1;
+
+    const auto lines = join_lines(options_.channels, per_line);
+    last_lines_ = lines.size();
+    const auto start = now_ns();
+    for (const auto &line : lines) peers_[id].client->queue(line);
+    peers_[id].client->flush();
+    if (!wait([&] { return peers_[id].joined == options_.channels; })) return -1;
+    const auto elapsed = now_ns() - start;
+
+    // gone from the server, and from its nick table, before the next round
+    peers_[id].client->queue("QUIT :reconnecting\r\n");
+    peers_[id].client->flush();
+    if (!wait([&] { return peers_[id].closed; })) return -1;
+    return elapsed;
+}
+
+double percentile_ms(std::vector<std::int64_t>& v, double q)
+{
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[static_cast<std::size_t>(q * (v.size() - 1))] / 1e6;
+}
+
+void usage(const char* argv0)
+{
+    std::fprintf(stderr,
+        "usage: %s [--host H] [--port P] [--channels N] [--users N] [--rounds N]\n", argv0);
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--host") == 0 && i + 1 < argc) options.host = argv[++i];
+        else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) options.port = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--channels") == 0 && i + 1 < argc) options.channels = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--users") == 0 && i + 1 < argc) options.users = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) options.rounds = std::max(1, std::atoi(argv[++i]));
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    Bench bench(options);
+    if (!bench.populate())
+    {
+        std::fprintf(stderr, "cannot set up %d members in %d channels on %s:%d\n",
+            options.users, options.channels, options.host.c_str(), options.port);
+        return 1;
+    }
+    std::printf("%d channels of %d members, %d reconnects each way\n",
+        options.channels, options.users, options.rounds);
+
+    auto run = [&] (const char* label, int per_line) {
+        std::vector<std::int64_t> ns;
+        for (int round = 0; round < options.rounds; ++round)
+        {
+            const auto elapsed = bench.reconnect(per_line);
+            if (elapsed < 0)
+            {
+                std::fprintf(stderr, "reconnect %d failed\n", round);
+                return false;
+            }
+            ns.push_back(elapsed);
+        }
+        std::printf("%-18s %4zu JOIN lines   p50 %.3fms  p99 %.3fms  max %.3fms\n", label, bench.last_lines(),
+            percentile_ms(ns, 0.5), percentile_ms(ns, 0.99), percentile_ms(ns, 1.0));
+        return true;
+    };
+
+    if (!run("one per JOIN", 1)) return 1;
+    if (bench.targmax() < 0)
+    {
+        std::printf("no TARGMAX for JOIN in 005, start the server with --isupport 1 to compare\n");
+        return 0;
+    }
+    return run("packed by TARGMAX", bench.targmax()) ? 0 : 1;
+}
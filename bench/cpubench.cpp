@@ -0,0 +1,264 @@
+// npcp_cpubench: protocol-layer CPU cost per command, with no I/O.
+//
+// Runs IrcServer over the in-memory transport: registers a population of
+// users, joins them into a skewed channel topology (a few big channels, many
+// small ones), then replays a fixed-seed command mix. Every line is timed
+// around the server's on_message, so the figures are parse + dispatch +
+// handler + reply formatting + fan-out into connection buffers, and the same
+// seed always produces the same sequence of commands.
+//
+//   npcp_cpubench [--users N] [--channels N] [--joins N] [--commands N] [--seed S]
+
+#include <array>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "harness.hpp"
+#include "metrics.hpp"
+
+namespace
+{
+using npcp::bench::Harness;
+
+struct Options
+{
+    int users = 100000;
+    int channels = 10000;
+    int joins = 3;                  // channels per user
+    long commands = 1000000;
+    std::uint64_t seed = 1;
+};
+
+enum Op
+{
+    kRegister, kJoinSetup, kChanPrivmsg, kUserPrivmsg, kChanNotice, kPing, kWho, kNames,
+    kTopic, kModeQuery, kPartJoin, kAway, kWhois, kNick, kLusers, kList, kOpCount
+};
+
+const char* const kOpNames[] = {
+    "NICK+USER (register)", "JOIN (setup)", "PRIVMSG #channel", "PRIVMSG nick",
+    "NOTICE #channel", "PING", "WHO #channel", "NAMES #channel", "TOPIC #channel",
+    "MODE #channel", "PART+JOIN", "AWAY", "WHOIS", "NICK (rename)", "LUSERS", "LIST"
+};
+
+// weights of the traffic phase, per mille
+const std::array<int, kOpCount> kMix = {
+    0, 0, 550, 100, 50, 60, 30, 20, 20, 20, 40, 20, 30, 20, 9, 1
+};
+
+struct Cost
+{
+    std::vector<std::uint32_t> ns;
+    std::int64_t total_ns = 0;
+    std::int64_t messages_out = 0;
+};
+
+class Bench
+{
+  public:
+    explicit Bench(const Options& options)
+      : options_(options),
+        harness_(false),
+        random_(options.seed),
+        nicks_(options.users),
+        channels_of_(options.users),
+        costs_(kOpCount)
+    {
+    }
+
+    void run();
+
+  private:
+    std::uint64_t pick(std::uint64_t n) { return random_() % n; }
+
+    // 1% of the channels draw 20% of the joins
+    int pick_channel()
+    {
+        const int big = std::max(1, options_.channels / 100);
+        if (pick(5) == 0) return static_cast<int>(pick(big));
+        return big + static_cast<int>(pick(options_.channels - big));
+    }
+
+    static std::string channel(int c) { return "#ch" + std::to_string(c); }
+
+    // one command, timed and charged to op
+    void issue(Op op, std::size_t user, const std::string& line);
+    void traffic();
+    void report(const char* phase, double seconds, std::initializer_list<Op> ops);
+
+    const Options& options_;
+    Harness harness_;
+    std::mt19937_64 random_;
+    std::vector<icarus::TcpConnectionPtr> conns_;
+    std::vector<std::string> nicks_;
+    std::vector<std::vector<int>> channels_of_;
+    std::vector<Cost> costs_;
+    int renames_ = 0;
+};
+
+void Bench::issue(Op op, std::size_t user, const std::string &line)
+{
+    auto &out = npcp::metrics::local().messages_out;
+    const auto sent = out.value();
+    const auto start = std::chrono::steady_clock::now();
+    harness_.send(conns_[user], line);
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    auto &cost = costs_[op];
+    cost.ns.push_back(static_cast<std::uint32_t>(std::min<std::int64_t>(ns, UINT32_MAX)));
+    cost.total_ns += ns;
+    cost.messages_out += out.value() - sent;
+}
+
+void Bench::traffic()
+{
+    std::array<int, kOpCount + 1> bound{};
+    for (int i = 0; i < kOpCount; ++i) bound[i + 1] = bound[i] + kMix[i];
+
+    for (long n = 0; n < options_.commands; ++n)
+    {
+        const auto roll = static_cast<int>(pick(bound[kOpCount]));
+        const auto op = static_cast<Op>(std::upper_bound(bound.begin(), bound.end(), roll) - bound.begin() - 1);
+        const auto user = pick(options_.users);
+        const auto &mine = channels_of_[user];
+        const auto chan = mine.empty() ? channel(0) : channel(mine[pick(mine.size())]);
+        const auto &peer = nicks_[pick(options_.users)];
+
+        switch (op)
+        {
+            case kChanPrivmsg:
+                issue(op, user, "PRIVMSG " + chan + " :the quick brown fox jumps over the lazy dog\r\n");
+                break;
+            case kUserPrivmsg:
+                issue(op, user, "PRIVMSG " + peer + " :hey, got a minute?\r\n");
+                break;
+            case kChanNotice:
+                issue(op, user, "NOTICE " + chan + " :build 4711 passed\r\n");
+                break;
+            case kPing:
+                issue(op, user, "PING jusot.com\r\n");
+                break;
+            case kWho:
+                issue(op, user, "WHO " + chan + "\r\n");
+                break;
+            case kNames:
+                issue(op, user, "NAMES " + chan + "\r\n");
+                break;
+            case kTopic:
+                issue(op, user, "TOPIC " + chan + " :release on friday\r\n");
+                break;
+            case kModeQuery:
+                issue(op, user, "MODE " + chan + "\r\n");
+                break;
+            case kPartJoin:
+                issue(op, user, "PART " + chan + "\r\nJOIN " + chan + "\r\n");
+                break;
+            case kAway:
+                issue(op, user, pick(2) ? "AWAY :lunch\r\n" : "AWAY\r\n");
+                break;
+            case kWhois:
+                issue(op, user, "WHOIS " + peer + "\r\n");
+                break;
+            case kNick:
+            {
+                auto nick = "r" + std::to_string(renames_++);
+                issue(op, user, "NICK " + nick + "\r\n");
+                nicks_[user] = std::move(nick);
+                break;
+            }
+            case kLusers:
+                issue(op, user, "LUSERS\r\n");
+                break;
+            case kList:
+                issue(op, user, "LIST\r\n");
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void Bench::report(const char* phase, double seconds, std::initializer_list<Op> ops)
+{
+    std::printf("\n%s: %.2fs\n", phase, seconds);
+    std::printf("  %-22s %10s %10s %10s %10s %12s\n", "command", "count", "ns/op", "p50", "p99", "sends/op");
+    for (auto op : ops)
+    {
+        auto &cost = costs_[op];
+        if (cost.ns.empty()) continue;
+        std::sort(cost.ns.begin(), cost.ns.end());
+        const auto count = static_cast<double>(cost.ns.size());
+        std::printf("  %-22s %10zu %10.0f %10u %10u %12.1f\n", kOpNames[op], cost.ns.size(),
+            cost.total_ns / count, cost.ns[cost.ns.size() / 2], cost.ns[cost.ns.size() * 99 / 100],
+            cost.messages_out / count);
+    }
+}
+
+void Bench::run()
+{
+    using clock = std::chrono::steady_clock;
+    auto seconds = [] (clock::time_point since) {
+        return std::chrono::duration<double>(clock::now() - since).count();
+    };
+
+    auto start = clock::now();
+    conns_.reserve(options_.users);
+    for (int i = 0; i < options_.users; ++i)
+    {
+        conns_.push_back(harness_.connect());
+        nicks_[i] = "u" + std::to_string(i);
+        issue(kRegister, i, "NICK " + nicks_[i] + "\r\nUSER " + nicks_[i] + " * * :Bench User\r\n");
+    }
+    report("register", seconds(start), { kRegister });
+
+    start = clock::now();
+    for (int round = 0; round < options_.joins; ++round)
+    {
+        for (int i = 0; i < options_.users; ++i)
+        {
+            int c = pick_channel();
+            auto &mine = channels_of_[i];
+            if (std::find(mine.begin(), mine.end(), c) != mine.end()) continue;
+            mine.push_back(c);
+            issue(kJoinSetup, i, "JOIN " + channel(c) + "\r\n");
+        }
+    }
+    report("join", seconds(start), { kJoinSetup });
+
+    start = clock::now();
+    traffic();
+    report("traffic", seconds(start), {
+        kChanPrivmsg, kUserPrivmsg, kChanNotice, kPing, kWho, kNames, kTopic,
+        kModeQuery, kPartJoin, kAway, kWhois, kNick, kLusers, kList
+    });
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--users") == 0) options.users = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--channels") == 0) options.channels = std::max(2, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--joins") == 0) options.joins = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--commands") == 0) options.commands = std::atol(argv[++i]);
+        else if (std::strcmp(argv[i], "--seed") == 0) options.seed = std::strtoull(argv[++i], nullptr, 10);
+    }
+
+    std::printf("%d users, %d channels, %d joins/user, %ld commands, seed %llu\n",
+        options.users, options.channels, options.joins, options.commands,
+        static_cast<unsigned long long>(options.seed));
+
+    Bench bench(options);
+    bench.run();
+    return 0;
+}
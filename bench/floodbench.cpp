@@ -0,0 +1,230 @@
+// npcp_floodbench: what one client pipelining a flood of lines costs
+// everyone else on its loop.
+//
+// Opens a set of quiet clients that each PING the server on a fixed interval
+// and times the PONG, plus one flooder that keeps the server's socket full of
+// pipelined PINGs. Run the server with --threads 0 so they all share its
+// loop, and compare --line-budget 0 with the default: without a budget a
+// probe that lands behind a big read waits for all of it.
+//
+//   npcp_floodbench [--host H] [--port P] [--clients N] [--duration S]
+//                   [--interval-ms MS] [--flood N]
+//
+// --flood is the lines the flooder writes at once, 0 measures the quiet
+// clients alone.
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "ircclient.hpp"
+
+namespace
+{
+using npcp::bench::IrcClient;
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int port = 7776;
+    int clients = 200;
+    double duration = 5;
+    int interval_ms = 10;
+    int flood = 10000;
+};
+
+std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::unique_ptr<IrcClient> connect_client(const Options& options, int epoll, std::uint64_t id, const std::string& nick)
+{
+    int fd = npcp::bench::connect_to(options.host, options.port);
+    if (fd < 0) return nullptr;
+
+    auto client = std::make_unique<IrcClient>(fd);
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u64 = id;
+    ::epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev);
+    client->queue("NICK " + nick + "\r\nUSER " + nick + " * * :npcp floodbench\r\n");
+    return client;
+}
+
+// writes options.flood PINGs at a time for as long as the server takes them,
+// reading and dropping the PONGs
+void flood(const Options& options, const std::atomic<bool>& stop, std::atomic<std::int64_t>& lines)
+{
+    int epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    auto client = connect_client(options, epoll, 0, "flooder");
+    if (client == nullptr)
+    {
+        std::fprintf(stderr, "flooder cannot connect\n");
+        ::close(epoll);
+        return;
+    }
+
+    std::string batch;
+    for (int i = 0; i < options.flood; ++i) batch += "PING flood\r\n";
+
+    epoll_event events[1];
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        if (!client->want_write())
+        {
+            client->queue(batch);
+            lines.fetch_add(options.flood, std::memory_order_relaxed);
+        }
+        if (!client->flush()) break;
+        ::epoll_wait(epoll, events, 1, 10);
+        if (!client->read_lines([] (std::string_view) { })) break;
+    }
+    ::close(epoll);
+}
+
+struct Probe
+{
+    std::unique_ptr<IrcClient> client;
+    bool registered = false;
+    std::int64_t next_ns = 0;
+    std::deque<std::int64_t> pings;     // send times of PINGs not answered yet
+};
+
+double percentile_ms(std::vector<std::int64_t>& v, double q)
+{
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[static_cast<std::size_t>(q * (v.size() - 1))] / 1e6;
+}
+
+void usage(const char* argv0)
+{
+    std::fprintf(stderr,
+        "usage: %s [--host H] [--port P] [--clients N] [--duration S] [--interval-ms MS] [--flood N]\n", argv0);
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--host") == 0 && i + 1 < argc) options.host = argv[++i];
+        else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) options.port = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--clients") == 0 && i + 1 < argc) options.clients = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--duration") == 0 && i + 1 < argc) options.duration = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--interval-ms") == 0 && i + 1 < argc) options.interval_ms = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--flood") == 0 && i + 1 < argc) options.flood = std::max(0, std::atoi(argv[++i]));
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Probe> probes(options.clients);
+    for (int i = 0; i < options.clients; ++i)
+    {
+        probes[i].client = connect_client(options, epoll, i, "probe" + std::to_string(i));
+        if (probes[i].client == nullptr)
+        {
+            std::fprintf(stderr, "cannot connect to %s:%d\n", options.host.c_str(), options.port);
+            return 1;
+        }
+    }
+
+    std::vector<std::int64_t> rtt;
+    int registered = 0;
+    auto poll = [&] (int timeout_ms) {
+        epoll_event events[256];
+        int n = ::epoll_wait(epoll, events, 256, timeout_ms);
+        for (int i = 0; i < n; ++i)
+        {
+            auto &probe = probes[events[i].data.u64];
+            if (events[i].events & EPOLLOUT) probe.client->flush();
+            probe.client->read_lines([&] (std::string_view line) {
+                if (line.find(" 001 ") != std::string_view::npos)
+                {
+                    probe.registered = true;
+                    ++registered;
+                }
+                else if (line.find(" PONG ") != std::string_view::npos && !probe.pings.empty())
+                {
+                    rtt.push_back(now_ns() - probe.pings.front());
+                    probe.pings.pop_front();
+                }
+            });
+        }
+    };
+
+    for (auto deadline = now_ns() + 10000000000; registered < options.clients; poll(10))
+    {
+        if (now_ns() > deadline)
+        {
+            std::fprintf(stderr, "only %d of %d clients registered\n", registered, options.clients);
+            return 1;
+        }
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<std::int64_t> flooded{0};
+    std::thread flooder;
+    if (options.flood > 0)
+    {
+        flooder = std::thread([&] { flood(options, stop, flooded); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+
+    // spread the probes evenly over the interval
+    const std::int64_t interval = options.interval_ms * 1000000LL;
+    const auto start = now_ns();
+    for (int i = 0; i < options.clients; ++i)
+        probes[i].next_ns = start + interval * i / options.clients;
+
+    const auto flooded_before = flooded.load();
+    const auto end = start + static_cast<std::int64_t>(options.duration * 1e9);
+    std::int64_t sent = 0;
+    for (auto now = start; now < end; now = now_ns())
+    {
+        for (auto &probe : probes)
+        {
+            if (probe.next_ns > now) continue;
+            probe.client->queue("PING probe\r\n");
+            probe.client->flush();
+            probe.pings.push_back(now);
+            probe.next_ns += interval;
+            ++sent;
+        }
+        poll(1);
+    }
+    const double seconds = (now_ns() - start) / 1e9;
+    const auto flood_lines = flooded.load() - flooded_before;
+
+    stop.store(true);
+    if (flooder.joinable()) flooder.join();
+    ::close(epoll);
+
+    std::printf("%d clients, PING every %dms, flood of %d lines at a time\n",
+        options.clients, options.interval_ms, options.flood);
+    std::printf("probes: %lld sent, %zu answered\n", static_cast<long long>(sent), rtt.size());
+    std::printf("probe latency: p50 %.3fms  p99 %.3fms  p999 %.3fms  max %.3fms\n",
+        percentile_ms(rtt, 0.5), percentile_ms(rtt, 0.99), percentile_ms(rtt, 0.999), percentile_ms(rtt, 1.0));
+    if (options.flood > 0)
+        std::printf("flooder: %.0f lines/s written\n", flood_lines / seconds);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "harness.hpp"
+
+namespace npcp
+{
+namespace bench
+{
+Harness::Harness(bool keep_output)
+  : server_(&loop_, icarus::InetAddress(0), "harness"),
+    net_(loop_.servers().front())
+{
+    net_->set_keep_output(keep_output);
+}
+
+icarus::TcpConnectionPtr Harness::connect()
+{
+    auto conn = net_->connect();
+    loop_.run_pending();
+    return conn;
+}
+
+void Harness::send(const icarus::TcpConnectionPtr &conn, std::string_view data)
+{
+    net_->deliver(conn, data);
+    loop_.run_pending();
+    if (conn->shutdown_requested()) close(conn);
+}
+
+std::string Harness::take_output(const icarus::TcpConnectionPtr &conn)
+{
+    std::string output;
+    output.swap(conn->output());
+    return output;
+}
+
+void Harness::close(const icarus::TcpConnectionPtr &conn)
+{
+    net_->disconnect(conn);
+    loop_.run_pending();
+}
+
+} // namespace bench
+} // namespace npcp
@@ -0,0 +1,50 @@
+#ifndef NPCP_BENCH_HARNESS_HPP
+#define NPCP_BENCH_HARNESS_HPP
+
+#include <string>
+#include <string_view>
+
+#include "ircserver.hpp"
+
+#include "icarus/eventloop.hpp"
+#include "icarus/tcpserver.hpp"
+#include "icarus/tcpconnection.hpp"
+
+namespace npcp
+{
+namespace bench
+{
+// An IrcServer wired to the in-memory transport under bench/memnet. Built
+// against those headers instead of icarus, the real on_message dispatch and
+// *_process handlers run synchronously on the caller's thread with no
+// sockets, syscalls or other threads involved.
+class Harness
+{
+  public:
+    // keep_output false only counts what the server sends, for big runs
+    explicit Harness(bool keep_output = true);
+
+    Harness(const Harness&) = delete;
+    Harness& operator=(const Harness&) = delete;
+
+    icarus::TcpConnectionPtr connect();
+
+    // hands data to the server as one read and runs whatever that queued;
+    // a connection the server shut down is closed afterwards
+    void send(const icarus::TcpConnectionPtr& conn, std::string_view data);
+
+    // what the server sent conn since the last call
+    std::string take_output(const icarus::TcpConnectionPtr& conn);
+
+    void close(const icarus::TcpConnectionPtr& conn);
+
+  private:
+    icarus::EventLoop loop_;
+    IrcServer server_;
+    icarus::TcpServer* net_;
+};
+
+} // namespace bench
+} // namespace npcp
+
+#endif // NPCP_BENCH_HARNESS_HPP
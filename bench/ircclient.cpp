@@ -0,0 +1,100 @@
+#include <cerrno>
+#include <cstring>
+
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "ircclient.hpp"
+
+namespace npcp
+{
+namespace bench
+{
+int connect_to(const std::string &host, std::uint16_t port)
+{
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0)
+        return -1;
+
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0)
+    {
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (::connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(res);
+    return fd;
+}
+
+IrcClient::IrcClient(int fd)
+  : fd_(fd),
+    sent_(0)
+{
+}
+
+IrcClient::~IrcClient()
+{
+    close();
+}
+
+void IrcClient::queue(std::string_view line)
+{
+    // compact once everything queued so far has been written
+    if (sent_ == out_.size())
+    {
+        out_.clear();
+        sent_ = 0;
+    }
+    out_.append(line);
+}
+
+bool IrcClient::flush()
+{
+    while (sent_ < out_.size())
+    {
+        auto n = ::send(fd_, out_.data() + sent_, out_.size() - sent_, MSG_NOSIGNAL);
+        if (n >= 0)
+            sent_ += n;
+        else if (errno != EINTR)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
+}
+
+bool IrcClient::fill()
+{
+    char buf[16384];
+    for (;;)
+    {
+        auto n = ::recv(fd_, buf, sizeof(buf), 0);
+        if (n > 0)
+            in_.append(buf, n);
+        else if (n == 0)
+            return false;
+        else if (errno != EINTR)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
+void IrcClient::close()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+} // namespace bench
+} // namespace npcp
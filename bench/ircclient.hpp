@@ -0,0 +1,69 @@
+#ifndef NPCP_BENCH_IRCCLIENT_HPP
+#define NPCP_BENCH_IRCCLIENT_HPP
+
+#include <string>
+#include <cstdint>
+#include <string_view>
+
+namespace npcp
+{
+namespace bench
+{
+// nonblocking TCP connect to host:port, -1 on failure
+int connect_to(const std::string& host, std::uint16_t port);
+
+// One nonblocking, line-oriented client socket. The owner drives it from its
+// own poller: queue() buffers outgoing lines, flush() writes what the kernel
+// takes, read_lines() drains the socket (so edge-triggered polling is fine)
+// and hands every complete inbound line to a callback.
+class IrcClient
+{
+  public:
+    explicit IrcClient(int fd);
+    ~IrcClient();
+
+    IrcClient(const IrcClient&) = delete;
+    IrcClient& operator=(const IrcClient&) = delete;
+
+    int fd() const { return fd_; }
+    bool want_write() const { return sent_ < out_.size(); }
+
+    void queue(std::string_view line);
+
+    // false once the connection is unusable
+    bool flush();
+
+    // f(std::string_view line) without the CRLF; false on EOF or error
+    template <typename F>
+    bool read_lines(F&& f);
+
+    void close();
+
+  private:
+    bool fill();
+
+    int fd_;
+    std::string in_;
+    std::string out_;
+    std::size_t sent_;
+};
+
+template <typename F>
+bool IrcClient::read_lines(F&& f)
+{
+    const bool open = fill();
+
+    std::size_t begin = 0, end;
+    while ((end = in_.find("\r\n", begin)) != std::string::npos)
+    {
+        f(std::string_view(in_).substr(begin, end - begin));
+        begin = end + 2;
+    }
+    in_.erase(0, begin);
+    return open;
+}
+
+} // namespace bench
+} // namespace npcp
+
+#endif // NPCP_BENCH_IRCCLIENT_HPP
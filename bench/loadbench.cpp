@@ -0,0 +1,498 @@
+// npcp_bench: event-driven IRC load generator.
+//
+// Each scenario opens a set of clients spread over worker threads (one epoll
+// each), registers them, joins them into a channel topology of many small
+// and a few huge channels, then drives a PRIVMSG/NOTICE/PART+JOIN mix at a
+// fixed total rate. Channel messages carry their send time, so every copy a
+// member receives yields one end-to-end delivery latency sample.
+//
+//   npcp_bench [options] [scenario...]
+//     --host H --port P      server, default 127.0.0.1:7776
+//     --threads N            worker threads, default 4
+//     --duration S           seconds of load per scenario, default 10
+//     --payload B            bytes of padding per message, default 64
+//     --clients N            override the scenario's client count
+//     --small N:SIZE         override the small channel topology
+//     --huge N:SIZE          override the huge channel topology
+//     --rate R               override the total operations per second
+//     --mix P:N:C            override the PRIVMSG:NOTICE:churn weights
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "ircclient.hpp"
+
+namespace
+{
+using npcp::bench::IrcClient;
+
+struct Scenario
+{
+    std::string name;
+    int clients;
+    int small_channels, small_size;
+    int huge_channels, huge_size;
+    double rate;                        // operations per second, all workers
+    int privmsg, notice, churn;         // weights of the operation mix
+};
+
+const Scenario kScenarios[] = {
+    { "small", 2000, 500, 8,  0, 0,     20000, 1, 0, 0 },
+    { "huge",  2000,   0, 0,  4, 1000,   2000, 1, 0, 0 },
+    { "mixed", 2000, 400, 8,  2, 1000,  10000, 6, 3, 1 },
+    { "churn", 2000, 500, 8,  0, 0,     10000, 1, 0, 1 },
+};
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int port = 7776;
+    int threads = 4;
+    double duration = 10;
+    int payload = 64;
+};
+
+std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// State every worker of one scenario run shares with the coordinator.
+struct Shared
+{
+    explicit Shared(std::size_t channels) : members(channels) { }
+
+    std::vector<std::atomic<int>> members;     // members as of our last JOIN/PART
+    std::atomic<int> ready{0};
+    std::atomic<int> failed{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};              // no more sends
+    std::atomic<bool> done{false};              // drained, tear down
+    std::atomic<std::int64_t> operations{0};
+    std::atomic<std::int64_t> expected{0};
+    std::atomic<std::int64_t> delivered{0};
+    std::atomic<std::int64_t> last_delivery_ns{0};
+};
+
+class Worker
+{
+  public:
+    Worker(const Options& options, const Scenario& scenario, std::size_t index,
+        const std::vector<std::vector<int>>& channels_of, Shared& shared)
+      : options_(options),
+        scenario_(scenario),
+        index_(index),
+        channels_of_(channels_of),
+        shared_(shared),
+        epoll_(::epoll_create1(EPOLL_CLOEXEC)),
+        random_(index),
+        pad_(options.payload, 'x')
+    {
+    }
+
+    ~Worker()
+    {
+        ::close(epoll_);
+    }
+
+    void run();
+
+    const std::vector<std::int64_t>& samples() const { return samples_; }
+
+  private:
+    struct Member
+    {
+        int id;
+        std::unique_ptr<IrcClient> client;
+        bool registered = false;
+        int joined = 0;
+    };
+
+    std::string nick(int id) const
+    {
+        return "b" + scenario_.name.substr(0, 2) + std::to_string(id);
+    }
+
+    std::string channel(int c) const
+    {
+        return "#b" + scenario_.name.substr(0, 2) + std::to_string(c);
+    }
+
+    bool connect();
+    // poll once for up to timeout_ms, false if a connection broke
+    bool poll(int timeout_ms);
+    void on_line(Member& m, std::string_view line);
+    template <typename Pred>
+    bool wait_for(Pred&& pred, double seconds);
+    void operate();
+
+    const Options& options_;
+    const Scenario& scenario_;
+    std::size_t index_;
+    const std::vector<std::vector<int>>& channels_of_;
+    Shared& shared_;
+
+    int epoll_;
+    std::mt19937_64 random_;
+    std::string pad_;
+    std::vector<Member> members_;
+    std::vector<std::size_t> speakers_;         // members that sit in a channel
+    std::vector<std::int64_t> samples_;
+    std::int64_t joins_expected_ = 0;
+    std::int64_t joins_done_ = 0;
+    std::int64_t registered_ = 0;
+    std::int64_t delivered_ = 0;
+};
+
+bool Worker::connect()
+{
+    for (int id = index_; id < scenario_.clients; id += options_.threads)
+    {
+        int fd = npcp::bench::connect_to(options_.host, options_.port);
+        if (fd < 0)
+        {
+            std::fprintf(stderr, "connect %s:%d: %s\n", options_.host.c_str(),
+                options_.port, std::strerror(errno));
+            return false;
+        }
+        members_.push_back({ id, std::make_unique<IrcClient>(fd) });
+    }
+
+    for (std::size_t i = 0; i < members_.size(); ++i)
+    {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u64 = i;
+        ::epoll_ctl(epoll_, EPOLL_CTL_ADD, members_[i].client->fd(), &ev);
+
+        auto name = nick(members_[i].id);
+        members_[i].client->queue("NICK " + name + "\r\nUSER " + name + " * * :npcp bench\r\n");
+        if (!channels_of_[members_[i].id].empty()) speakers_.push_back(i);
+    }
+    return true;
+}
+
+void Worker::on_line(Member &m, std::string_view line)
+{
+    // ":nick!user@host PRIVMSG #chan :t=<ns> ...", or a numeric reply
+    auto stamp = line.find(" :t=");
+    if (stamp != std::string_view::npos)
+    {
+        std::int64_t sent = 0;
+        for (auto i = stamp + 4; i < line.size() && line[i] >= '0' && line[i] <= '9'; ++i)
+            sent = sent * 10 + (line[i] - '0');
+        const auto now = now_ns();
+        samples_.push_back(now - sent);
+        ++delivered_;
+        shared_.delivered.fetch_add(1, std::memory_order_relaxed);
+        shared_.last_delivery_ns.store(now, std::memory_order_relaxed);
+        return;
+    }
+
+    auto space = line.find(' ');
+    if (space == std::string_view::npos) return;
+    auto code = line.substr(space + 1, 4);
+    if (code == "001 ")
+    {
+        m.registered = true;
+        ++registered_;
+    }
+    else if (code == "366 ")
+    {
+        ++m.joined;
+        ++joins_done_;
+    }
+    else if (code == "433 " || line.substr(0, 5) == "ERROR")
+    {
+        std::fprintf(stderr, "client %d: %.*s\n", m.id, static_cast<int>(line.size()), line.data());
+        shared_.failed.fetch_add(1);
+    }
+}
+
+bool Worker::poll(int timeout_ms)
+{
+    epoll_event events[256];
+    int n = ::epoll_wait(epoll_, events, 256, timeout_ms);
+    for (int i = 0; i < n; ++i)
+    {
+        auto &m = members_[events[i].data.u64];
+        bool ok = true;
+        if (events[i].events & EPOLLOUT) ok = m.client->flush();
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            ok = m.client->read_lines([&] (std::string_view line) { on_line(m, line); }) && ok;
+        if (!ok)
+        {
+            std::fprintf(stderr, "client %d: connection lost\n", m.id);
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Pred>
+bool Worker::wait_for(Pred &&pred, double seconds)
+{
+    const auto deadline = now_ns() + static_cast<std::int64_t>(seconds * 1e9);
+    while (!pred())
+    {
+        if (now_ns() > deadline || shared_.failed.load()) return false;
+        if (!poll(10)) return false;
+    }
+    return true;
+}
+
+void Worker::operate()
+{
+    if (speakers_.empty()) return;
+
+    auto &m = members_[speakers_[random_() % speakers_.size()]];
+    const auto &channels = channels_of_[m.id];
+    const int c = channels[random_() % channels.size()];
+    const auto name = channel(c);
+
+    const int total = scenario_.privmsg + scenario_.notice + scenario_.churn;
+    const int pick = static_cast<int>(random_() % total);
+    if (pick < scenario_.privmsg + scenario_.notice)
+    {
+        const char *command = pick < scenario_.privmsg ? "PRIVMSG " : "NOTICE ";
+        m.client->queue(command + name + " :t=" + std::to_string(now_ns()) + ' ' + pad_ + "\r\n");
+        shared_.expected.fetch_add(shared_.members[c].load(std::memory_order_relaxed) - 1,
+            std::memory_order_relaxed);
+    }
+    else
+    {
+        // leave and come straight back: two relays plus a NAMES reply
+        m.client->queue("PART " + name + "\r\nJOIN " + name + "\r\n");
+    }
+    m.client->flush();
+    shared_.operations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Worker::run()
+{
+    if (!connect()) { shared_.failed.fetch_add(1); return; }
+    for (auto &m : members_) m.client->flush();
+
+    if (!wait_for([&] { return registered_ == static_cast<std::int64_t>(members_.size()); }, 30))
+    {
+        std::fprintf(stderr, "worker %zu: %lld of %zu clients registered\n", index_,
+            static_cast<long long>(registered_), members_.size());
+        shared_.failed.fetch_add(1);
+        return;
+    }
+
+    for (auto &m : members_)
+    {
+        for (int c : channels_of_[m.id])
+        {
+            m.client->queue("JOIN " + channel(c) + "\r\n");
+            shared_.members[c].fetch_add(1, std::memory_order_relaxed);
+            ++joins_expected_;
+        }
+        m.client->flush();
+    }
+    if (!wait_for([&] { return joins_done_ >= joins_expected_; }, 120))
+    {
+        std::fprintf(stderr, "worker %zu: %lld of %lld joins done\n", index_,
+            static_cast<long long>(joins_done_), static_cast<long long>(joins_expected_));
+        shared_.failed.fetch_add(1);
+        return;
+    }
+
+    shared_.ready.fetch_add(1);
+    while (!shared_.go.load() && !shared_.failed.load())
+        if (!poll(1)) { shared_.failed.fetch_add(1); return; }
+
+    // keep to the rate by owing operations for the elapsed time; a short cap
+    // per tick means a generator that falls behind reports a lower rate
+    // instead of bursting to catch up
+    const double rate = scenario_.rate / options_.threads;
+    const auto start = now_ns();
+    std::int64_t issued = 0;
+    while (!shared_.stop.load())
+    {
+        const auto owed = static_cast<std::int64_t>((now_ns() - start) * 1e-9 * rate) - issued;
+        for (std::int64_t i = 0; i < std::min<std::int64_t>(owed, 512); ++i) operate();
+        issued += std::max<std::int64_t>(owed, 0);
+        if (!poll(1)) { shared_.failed.fetch_add(1); return; }
+    }
+
+    while (!shared_.done.load())
+        if (!poll(5)) break;
+
+    for (auto &m : members_)
+    {
+        m.client->queue("QUIT :bench done\r\n");
+        m.client->flush();
+    }
+}
+
+struct Report
+{
+    std::int64_t operations = 0;
+    std::int64_t expected = 0;
+    std::int64_t delivered = 0;
+    double seconds = 0;
+    std::vector<std::int64_t> samples;
+};
+
+double percentile_ms(const std::vector<std::int64_t>& sorted, double q)
+{
+    if (sorted.empty()) return 0;
+    auto i = static_cast<std::size_t>(q * (sorted.size() - 1));
+    return sorted[i] / 1e6;
+}
+
+bool run_scenario(const Options& options, const Scenario& scenario, Report& report)
+{
+    // members of small channel k are clients k*size .. k*size+size-1 (mod
+    // clients), huge channels take consecutive runs the same way, so every
+    // client sits in a predictable number of channels
+    std::vector<std::vector<int>> channels_of(scenario.clients);
+    int c = 0;
+    for (int k = 0; k < scenario.small_channels; ++k, ++c)
+        for (int j = 0; j < scenario.small_size; ++j)
+            channels_of[(k * scenario.small_size + j) % scenario.clients].push_back(c);
+    for (int k = 0; k < scenario.huge_channels; ++k, ++c)
+        for (int j = 0; j < scenario.huge_size; ++j)
+            channels_of[(k * scenario.huge_size + j) % scenario.clients].push_back(c);
+
+    Shared shared(c);
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.threads; ++i)
+    {
+        workers.push_back(std::make_unique<Worker>(options, scenario, i, channels_of, shared));
+        threads.emplace_back([w = workers.back().get()] { w->run(); });
+    }
+
+    while (shared.ready.load() < options.threads && !shared.failed.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    const auto start = now_ns();
+    if (!shared.failed.load())
+    {
+        shared.go.store(true);
+        std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+        shared.stop.store(true);
+
+        // drain until every expected copy arrived or deliveries went quiet
+        shared.last_delivery_ns.store(now_ns());
+        while (shared.delivered.load() < shared.expected.load()
+            && now_ns() - shared.last_delivery_ns.load() < 2000000000)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    report.seconds = (now_ns() - start) * 1e-9;
+    shared.done.store(true);
+    for (auto &t : threads) t.join();
+
+    report.operations = shared.operations.load();
+    report.expected = shared.expected.load();
+    report.delivered = shared.delivered.load();
+    for (const auto &w : workers)
+        report.samples.insert(report.samples.end(), w->samples().begin(), w->samples().end());
+    std::sort(report.samples.begin(), report.samples.end());
+    return shared.failed.load() == 0;
+}
+
+bool parse_pair(const char* arg, int& a, int& b)
+{
+    return std::sscanf(arg, "%d:%d", &a, &b) == 2;
+}
+
+void usage(const char* argv0)
+{
+    std::fprintf(stderr, "usage: %s [--host H] [--port P] [--threads N] [--duration S] [--payload B]\n"
+        "       [--clients N] [--small N:SIZE] [--huge N:SIZE] [--rate R] [--mix P:N:C] [scenario...]\n"
+        "scenarios:", argv0);
+    for (const auto &s : kScenarios) std::fprintf(stderr, " %s", s.name.c_str());
+    std::fprintf(stderr, "\n");
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    Scenario over{ "", -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+    std::vector<Scenario> scenarios;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--host") == 0 && has_value) options.host = argv[++i];
+        else if (std::strcmp(arg, "--port") == 0 && has_value) options.port = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--threads") == 0 && has_value) options.threads = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(arg, "--duration") == 0 && has_value) options.duration = std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--payload") == 0 && has_value) options.payload = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--clients") == 0 && has_value) over.clients = std::atoi(argv[++i]);
+        else if (std::strcmp(arg, "--rate") == 0 && has_value) over.rate = std::atof(argv[++i]);
+        else if (std::strcmp(arg, "--small") == 0 && has_value && parse_pair(argv[++i], over.small_channels, over.small_size)) { }
+        else if (std::strcmp(arg, "--huge") == 0 && has_value && parse_pair(argv[++i], over.huge_channels, over.huge_size)) { }
+        else if (std::strcmp(arg, "--mix") == 0 && has_value
+            && std::sscanf(argv[++i], "%d:%d:%d", &over.privmsg, &over.notice, &over.churn) == 3) { }
+        else if (arg[0] != '-')
+        {
+            auto it = std::find_if(std::begin(kScenarios), std::end(kScenarios),
+                [&] (const Scenario& s) { return s.name == arg; });
+            if (it == std::end(kScenarios)) { usage(argv[0]); return 1; }
+            scenarios.push_back(*it);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (scenarios.empty()) scenarios.assign(std::begin(kScenarios), std::end(kScenarios));
+
+    bool ok = true;
+    for (auto s : scenarios)
+    {
+        if (over.clients > 0) s.clients = over.clients;
+        if (over.small_channels >= 0) { s.small_channels = over.small_channels; s.small_size = over.small_size; }
+        if (over.huge_channels >= 0) { s.huge_channels = over.huge_channels; s.huge_size = over.huge_size; }
+        if (over.rate > 0) s.rate = over.rate;
+        if (over.privmsg >= 0) { s.privmsg = over.privmsg; s.notice = over.notice; s.churn = over.churn; }
+        s.small_size = std::min(s.small_size, s.clients);
+        s.huge_size = std::min(s.huge_size, s.clients);
+        if (s.privmsg + s.notice + s.churn <= 0) s.privmsg = 1;
+
+        std::printf("%s: %d clients, %d x %d + %d x %d channels, %.0f ops/s, mix %d:%d:%d\n",
+            s.name.c_str(), s.clients, s.small_channels, s.small_size, s.huge_channels,
+            s.huge_size, s.rate, s.privmsg, s.notice, s.churn);
+        std::fflush(stdout);
+
+        Report r;
+        if (!run_scenario(options, s, r))
+        {
+            std::printf("  failed\n");
+            ok = false;
+            continue;
+        }
+        std::printf("  ops %lld (%.0f/s)  delivered %lld of %lld (%.0f msg/s)\n",
+            static_cast<long long>(r.operations), r.operations / options.duration,
+            static_cast<long long>(r.delivered), static_cast<long long>(r.expected),
+            r.delivered / r.seconds);
+        std::printf("  latency p50 %.3fms  p99 %.3fms  p999 %.3fms  max %.3fms\n",
+            percentile_ms(r.samples, 0.5), percentile_ms(r.samples, 0.99),
+            percentile_ms(r.samples, 0.999), percentile_ms(r.samples, 1.0));
+        std::fflush(stdout);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+#ifndef NPCP_BENCH_MEMNET_BUFFER_HPP
+#define NPCP_BENCH_MEMNET_BUFFER_HPP
+
+#include <string>
+#include <cstddef>
+#include <string_view>
+
+namespace icarus
+{
+// Input side of an in-memory connection: bytes appended by the harness and
+// read back by the server through the same calls it uses on icarus::Buffer.
+class Buffer
+{
+  public:
+    const char* peek() const { return data_.data() + read_; }
+    std::size_t readable_bytes() const { return data_.size() - read_; }
+
+    const char* findCRLF() const
+    {
+        auto pos = data_.find("\r\n", read_);
+        return pos == std::string::npos ? nullptr : data_.data() + pos;
+    }
+
+    std::string retrieve_as_string(std::size_t len)
+    {
+        std::string result(peek(), len);
+        read_ += len;
+        if (read_ == data_.size())
+        {
+            data_.clear();
+            read_ = 0;
+        }
+        return result;
+    }
+
+    void append(std::string_view data) { data_.append(data); }
+
+  private:
+    std::string data_;
+    std::size_t read_ = 0;
+};
+
+} // namespace icarus
+
+#endif // NPCP_BENCH_MEMNET_BUFFER_HPP
@@ -0,0 +1,18 @@
+#ifndef NPCP_BENCH_MEMNET_CALLBACKS_HPP
+#define NPCP_BENCH_MEMNET_CALLBACKS_HPP
+
+#include <memory>
+#include <functional>
+
+namespace icarus
+{
+class Buffer;
+class TcpConnection;
+
+using TcpConnectionPtr = std::shared_ptr<TcpConnection>;
+using ConnectionCallback = std::function<void(const TcpConnectionPtr&)>;
+using MessageCallback = std::function<void(const TcpConnectionPtr&, Buffer*)>;
+
+} // namespace icarus
+
+#endif // NPCP_BENCH_MEMNET_CALLBACKS_HPP
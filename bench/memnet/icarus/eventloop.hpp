@@ -0,0 +1,42 @@
+#ifndef NPCP_BENCH_MEMNET_EVENTLOOP_HPP
+#define NPCP_BENCH_MEMNET_EVENTLOOP_HPP
+
+#include <mutex>
+#include <vector>
+#include <functional>
+
+namespace icarus
+{
+class TcpServer;
+
+// A loop that never blocks: queued functors wait until the harness calls
+// run_pending(), so a run is a deterministic sequence of callbacks on the
+// harness's own thread.
+class EventLoop
+{
+  public:
+    using Functor = std::function<void()>;
+
+    void loop();
+    void quit();
+    void run_in_loop(Functor cb);
+    void queue_in_loop(Functor cb);
+
+    // runs everything queued so far, including what those functors queue
+    std::size_t run_pending();
+
+    // servers constructed on this loop, in construction order
+    const std::vector<TcpServer*>& servers() const { return servers_; }
+
+  private:
+    friend class TcpServer;
+
+    std::mutex mutex_;
+    std::vector<Functor> pending_;
+    std::vector<TcpServer*> servers_;
+    bool quit_ = false;
+};
+
+} // namespace icarus
+
+#endif // NPCP_BENCH_MEMNET_EVENTLOOP_HPP
@@ -0,0 +1,22 @@
+#ifndef NPCP_BENCH_MEMNET_INETADDRESS_HPP
+#define NPCP_BENCH_MEMNET_INETADDRESS_HPP
+
+#include <cstdint>
+
+namespace icarus
+{
+// nothing listens in memory, the port is only remembered
+class InetAddress
+{
+  public:
+    explicit InetAddress(std::uint16_t port = 0, bool loopback = false) : port_(port) { }
+
+    std::uint16_t port() const { return port_; }
+
+  private:
+    std::uint16_t port_;
+};
+
+} // namespace icarus
+
+#endif // NPCP_BENCH_MEMNET_INETADDRESS_HPP
@@ -0,0 +1,56 @@
+#ifndef NPCP_BENCH_MEMNET_TCPCONNECTION_HPP
+#define NPCP_BENCH_MEMNET_TCPCONNECTION_HPP
+
+#include <string>
+#include <cstdint>
+
+#include "buffer.hpp"
+#include "callbacks.hpp"
+#include "eventloop.hpp"
+
+namespace icarus
+{
+// One end of an in-memory connection. What the server sends is appended to
+// output() (or only counted, when the server discards output), shutdown()
+// is recorded for the harness to act on.
+class TcpConnection : public std::enable_shared_from_this<TcpConnection>
+{
+  public:
+    TcpConnection(EventLoop* loop, bool keep_output)
+      : loop_(loop), keep_output_(keep_output) { }
+
+    EventLoop* get_loop() const { return loop_; }
+    bool connected() const { return connected_; }
+
+    void send(const std::string& message)
+    {
+        if (!connected_) return;
+        ++messages_out_;
+        bytes_out_ += message.size();
+        if (keep_output_) output_.append(message);
+    }
+
+    void shutdown() { shutdown_ = true; }
+
+    // harness side
+    Buffer* input() { return &input_; }
+    std::string& output() { return output_; }
+    bool shutdown_requested() const { return shutdown_; }
+    void set_connected(bool connected) { connected_ = connected; }
+    std::uint64_t messages_out() const { return messages_out_; }
+    std::uint64_t bytes_out() const { return bytes_out_; }
+
+  private:
+    EventLoop* loop_;
+    bool keep_output_;
+    bool connected_ = false;
+    bool shutdown_ = false;
+    Buffer input_;
+    std::string output_;
+    std::uint64_t messages_out_ = 0;
+    std::uint64_t bytes_out_ = 0;
+};
+
+} // namespace icarus
+
+#endif // NPCP_BENCH_MEMNET_TCPCONNECTION_HPP
@@ -0,0 +1,42 @@
+#ifndef NPCP_BENCH_MEMNET_TCPSERVER_HPP
+#define NPCP_BENCH_MEMNET_TCPSERVER_HPP
+
+#include <string>
+#include <string_view>
+
+#include "callbacks.hpp"
+#include "eventloop.hpp"
+#include "inetaddress.hpp"
+#include "tcpconnection.hpp"
+
+namespace icarus
+{
+// Accepts nothing by itself: the harness opens connections with connect()
+// and feeds them bytes with deliver(), which run the server's callbacks
+// synchronously exactly as an I/O loop would.
+class TcpServer
+{
+  public:
+    TcpServer(EventLoop* loop, const InetAddress& addr, std::string name);
+
+    void set_thread_num(int) { }
+    void set_connection_callback(const ConnectionCallback& cb) { connection_callback_ = cb; }
+    void set_message_callback(const MessageCallback& cb) { message_callback_ = cb; }
+    void start() { }
+
+    // harness side
+    void set_keep_output(bool keep) { keep_output_ = keep; }
+    TcpConnectionPtr connect();
+    void deliver(const TcpConnectionPtr& conn, std::string_view data);
+    void disconnect(const TcpConnectionPtr& conn);
+
+  private:
+    EventLoop* loop_;
+    bool keep_output_ = true;
+    ConnectionCallback connection_callback_;
+    MessageCallback message_callback_;
+};
+
+} // namespace icarus
+
+#endif // NPCP_BENCH_MEMNET_TCPSERVER_HPP
@@ -0,0 +1,70 @@
+#include "icarus/eventloop.hpp"
+#include "icarus/tcpserver.hpp"
+
+namespace icarus
+{
+void EventLoop::loop()
+{
+    while (!quit_) run_pending();
+}
+
+void EventLoop::quit()
+{
+    quit_ = true;
+}
+
+void EventLoop::run_in_loop(Functor cb)
+{
+    cb();
+}
+
+void EventLoop::queue_in_loop(Functor cb)
+{
+    std::lock_guard lock(mutex_);
+    pending_.push_back(std::move(cb));
+}
+
+std::size_t EventLoop::run_pending()
+{
+    std::size_t ran = 0;
+    for (;;)
+    {
+        std::vector<Functor> functors;
+        {
+            std::lock_guard lock(mutex_);
+            functors.swap(pending_);
+        }
+        if (functors.empty()) return ran;
+        for (const auto &f : functors) f();
+        ran += functors.size();
+    }
+}
+
+TcpServer::TcpServer(EventLoop *loop, const InetAddress &, std::string)
+  : loop_(loop)
+{
+    loop->servers_.push_back(this);
+}
+
+TcpConnectionPtr TcpServer::connect()
+{
+    auto conn = std::make_shared<TcpConnection>(loop_, keep_output_);
+    conn->set_connected(true);
+    if (connection_callback_) connection_callback_(conn);
+    return conn;
+}
+
+void TcpServer::deliver(const TcpConnectionPtr &conn, std::string_view data)
+{
+    conn->input()->append(data);
+    if (message_callback_) message_callback_(conn, conn->input());
+}
+
+void TcpServer::disconnect(const TcpConnectionPtr &conn)
+{
+    if (!conn->connected()) return;
+    conn->set_connected(false);
+    if (connection_callback_) connection_callback_(conn);
+}
+
+} // namespace icarus
@@ -0,0 +1,215 @@
+// Per-line costs: Message construction across line shapes, every reply
+// formatter in rplfuncs and the cal_hash command dispatch. Reports ns/op and
+// heap allocations/op; run it before and after touching message.cpp or
+// rplfuncs.cpp.
+//
+//   npcp_microbench [filter]    only cases whose name contains filter
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "alloccounter.hpp"
+#include "message.hpp"
+#include "rplfuncs.hpp"
+#include "hash.hpp"
+
+namespace
+{
+using namespace npcp;
+
+const char* g_filter = nullptr;
+
+// keeps the compiler from discarding a result it can see is unused
+template <typename T>
+void keep(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+template <typename F>
+void bench(const char* name, F&& f)
+{
+    if (g_filter && !std::strstr(name, g_filter)) return;
+
+    keep(f());  // warm up lazily allocated statics
+
+    // grow the batch until it runs long enough to time
+    using clock = std::chrono::steady_clock;
+    std::size_t rounds = 1000;
+    for (;;)
+    {
+        const auto allocs = bench::allocations();
+        const auto start = clock::now();
+        for (std::size_t i = 0; i < rounds; ++i) keep(f());
+        const std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+
+        if (elapsed.count() >= 50e6 || rounds >= (std::size_t(1) << 30))
+        {
+            std::printf("%-36s %9.1f ns/op %7.2f allocs/op\n", name,
+                elapsed.count() / rounds,
+                static_cast<double>(bench::allocations() - allocs) / rounds);
+            return;
+        }
+        rounds *= 2;
+    }
+}
+
+// the command set IrcServer::on_message switches over
+int dispatch(const std::string& command)
+{
+    switch (cal_hash(command.c_str()))
+    {
+        case "NICK"_hash:    return 1;
+        case "USER"_hash:    return 2;
+        case "QUIT"_hash:    return 3;
+        case "PRIVMSG"_hash: return 4;
+        case "NOTICE"_hash:  return 5;
+        case "PING"_hash:    return 6;
+        case "PONG"_hash:    return 7;
+        case "MOTD"_hash:    return 8;
+        case "LUSERS"_hash:  return 9;
+        case "WHOIS"_hash:   return 10;
+        case "OPER"_hash:    return 11;
+        case "MODE"_hash:    return 12;
+        case "JOIN"_hash:    return 13;
+        case "PART"_hash:    return 14;
+        case "TOPIC"_hash:   return 15;
+        case "AWAY"_hash:    return 16;
+        case "NAMES"_hash:   return 17;
+        case "LIST"_hash:    return 18;
+        case "WHO"_hash:     return 19;
+        case "STATS"_hash:   return 20;
+        default:             return 0;
+    }
+}
+
+void message_cases()
+{
+    const std::string privmsg = "PRIVMSG #general :hello there, this is a fairly ordinary chat line\r\n";
+    const std::string prefixed = ":alice!alice_user@jusot.com PRIVMSG #general :hello there\r\n";
+    const std::string ping = "PING jusot.com\r\n";
+    const std::string user = "USER alice * * :Alice Liddell\r\n";
+    const std::string params15 = "MODE a b c d e f g h i j k l m n o\r\n";
+    const std::string overlong = "PRIVMSG #general :" + std::string(600, 'x') + "\r\n";
+    const std::string spaced = "   JOIN    #general   \r\n";
+
+    bench("Message PING", [&] { return Message(ping); });
+    bench("Message PRIVMSG trailing", [&] { return Message(privmsg); });
+    bench("Message prefixed PRIVMSG", [&] { return Message(prefixed); });
+    bench("Message USER 4 params", [&] { return Message(user); });
+    bench("Message MODE 15 params", [&] { return Message(params15); });
+    bench("Message overlong 620 bytes", [&] { return Message(overlong); });
+    bench("Message extra spaces", [&] { return Message(spaced); });
+}
+
+void hash_cases()
+{
+    const std::vector<std::string> commands = {
+        "NICK", "USER", "PRIVMSG", "NOTICE", "PING", "JOIN", "PART", "WHOIS", "STATS", "BOGUS"
+    };
+
+    std::size_t i = 0;
+    bench("cal_hash PRIVMSG", [&] { return cal_hash(commands[2].c_str()); });
+    bench("dispatch mixed commands", [&] { return dispatch(commands[i++ % commands.size()]); });
+}
+
+void reply_cases()
+{
+    using namespace npcp::reply;
+
+    const std::string nick = "alice", user = "alice_user", peer = "bob";
+    const std::string channel = "#general", host = "client.example.net";
+    const std::string text = "hello there, this is a fairly ordinary chat line";
+    std::vector<std::string> nicks;
+    for (int i = 0; i < 20; ++i) nicks.push_back("@user" + std::to_string(i));
+    std::vector<std::string> many, chunks(1);
+    for (int i = 0; i < 500; ++i) many.push_back("user" + std::to_string(i));
+    for (const auto &name : many)
+    {
+        if (chunks.back().size() + 1 + name.size() > namreply_room(nick.size(), channel)) chunks.emplace_back();
+        else if (!chunks.back().empty()) chunks.back().push_back(' ');
+        chunks.back().append(name);
+    }
+
+    bench("rpl_pong", [&] { return rpl_pong("jusot.com"); });
+    bench("rpl_privmsg_or_notice", [&] { return rpl_privmsg_or_notice(nick, user, true, channel, text); });
+    bench("rpl_join", [&] { return rpl_join(nick, user, channel); });
+    bench("rpl_part", [&] { return rpl_part(nick, user, channel, text); });
+    bench("rpl_relayed_topic", [&] { return rpl_relayed_topic(nick, user, channel, text); });
+    bench("rpl_relayed_nick", [&] { return rpl_relayed_nick(nick, user, peer); });
+    bench("rpl_relayed_quit", [&] { return rpl_relayed_quit(nick, user, text); });
+    bench("rpl_relayed_mode", [&] { return rpl_relayed_mode(nick, user, channel, "+mo-v alice bob"); });
+
+    bench("rpl_welcome 001", [&] { return rpl_welcome(nick, user, host); });
+    bench("rpl_yourhost 002", [&] { return rpl_yourhost(nick, "npcp-0.1"); });
+    bench("rpl_created 003", [&] { return rpl_created(nick); });
+    bench("rpl_myinfo 004", [&] { return rpl_myinfo(nick, "npcp-0.1", "ao", "mtov"); });
+    bench("rpl_statscommands 212", [&] { return rpl_statscommands(nick, "PRIVMSG", 123456, 7890123); });
+    bench("rpl_endofstats 219", [&] { return rpl_endofstats(nick, "m"); });
+    bench("rpl_statsdebug 249", [&] { return rpl_statsdebug(nick, "p", text); });
+    bench("rpl_luserclient 251", [&] { return rpl_luserclient(nick, 1000, 0, 1); });
+    bench("rpl_luserop 252", [&] { return rpl_luserop(nick, 3); });
+    bench("rpl_luserunknown 253", [&] { return rpl_luserunknown(nick, 7); });
+    bench("rpl_luserchannels 254", [&] { return rpl_luserchannels(nick, 200); });
+    bench("rpl_luserme 255", [&] { return rpl_luserme(nick, 1000, 0); });
+    bench("rpl_away 301", [&] { return rpl_away(nick, peer, text); });
+    bench("rpl_unaway 305", [&] { return rpl_unaway(nick); });
+    bench("rpl_nowaway 306", [&] { return rpl_nowaway(nick); });
+    bench("rpl_whoisuser 311", [&] { return rpl_whoisuser(nick, user, "Alice Liddell"); });
+    bench("rpl_whoisserver 312", [&] { return rpl_whoisserver(nick); });
+    bench("rpl_whoisoperator 313", [&] { return rpl_whoisoperator(nick, peer); });
+    bench("rpl_endofwho 315", [&] { return rpl_endofwho(nick, channel); });
+    bench("rpl_endofwhois 318", [&] { return rpl_endofwhois(nick); });
+    bench("rpl_whoischannels 319", [&] { return rpl_whoischannels(nick, "@#general +#random #help"); });
+    bench("rpl_list 322", [&] { return rpl_list(nick, channel, 42, text); });
+    bench("rpl_listend 323", [&] { return rpl_listend(nick); });
+    bench("rpl_channelmodeis 324", [&] { return rpl_channelmodeis(nick, channel, "+mt"); });
+    bench("rpl_notopic 331", [&] { return rpl_notopic(nick, channel); });
+    bench("rpl_topic 332", [&] { return rpl_topic(nick, channel, text); });
+    bench("rpl_whoreply 352", [&] {
+        return rpl_whoreply(nick, channel, user, host, "jusot.com", peer, "H@", "Bob Example");
+    });
+    bench("rpl_namreply 353 (20 nicks)", [&] { return rpl_namreply(nick, channel, nicks); });
+    bench("rpl_namreply 353 (500 nicks, split)", [&] { return rpl_namreply(nick, channel, many); });
+    bench("rpl_namreply_chunks 353 (500 nicks)", [&] { return rpl_namreply_chunks(nick, channel, chunks); });
+    bench("rpl_endofnames 366", [&] { return rpl_endofnames(nick, channel); });
+    bench("rpl_motd 372", [&] { return rpl_motd(nick, text); });
+    bench("rpl_motdstart 375", [&] { return rpl_motdstart(nick); });
+    bench("rpl_endofmotd 376", [&] { return rpl_endofmotd(nick); });
+    bench("rpl_youareoper 381", [&] { return rpl_youareoper(nick); });
+
+    bench("err_nosuchnick 401", [&] { return err_nosuchnick(nick, peer); });
+    bench("err_nosuchchannel 403", [&] { return err_nosuchchannel(nick, channel); });
+    bench("err_cannotsendtochan 404", [&] { return err_cannotsendtochan(nick, channel); });
+    bench("err_norecipient 411", [&] { return err_norecipient(nick, "PRIVMSG"); });
+    bench("err_notexttosend 412", [&] { return err_notexttosend(nick); });
+    bench("err_unknowncommand 421", [&] { return err_unknowncommand(nick, "BOGUS"); });
+    bench("err_nomotd 422", [&] { return err_nomotd(nick); });
+    bench("err_nonicknamegiven 431", [&] { return err_nonicknamegiven(); });
+    bench("err_nicknameinuse 433", [&] { return err_nicknameinuse(nick); });
+    bench("err_usernotinchannel 441", [&] { return err_usernotinchannel(nick, peer, channel); });
+    bench("err_notonchannel 442", [&] { return err_notonchannel(nick, channel); });
+    bench("err_notregistered 451", [&] { return err_notregistered(nick); });
+    bench("err_needmoreparams 461", [&] { return err_needmoreparams(nick, "JOIN"); });
+    bench("err_alreadyregistered 462", [&] { return err_alreadyregistered(); });
+    bench("err_passwdmismatch 464", [&] { return err_passwdmismatch(nick); });
+    bench("err_unknownmode 472", [&] { return err_unknownmode(nick, 'q', channel); });
+    bench("err_noprivileges 481", [&] { return err_noprivileges(nick); });
+    bench("err_chanoprivsneeded 482", [&] { return err_chanoprivsneeded(nick, channel); });
+    bench("err_umodeunknownflag 501", [&] { return err_umodeunknownflag(nick); });
+    bench("err_usersdontmatch 502", [&] { return err_usersdontmatch(nick); });
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1) g_filter = argv[1];
+
+    message_cases();
+    hash_cases();
+    reply_cases();
+    return 0;
+}
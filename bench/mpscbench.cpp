@@ -0,0 +1,140 @@
+// Cross-thread posting into one consumer loop, the way channel fan-out hits
+// an EventLoop: many producers, one eventfd-woken consumer. Compares a
+// mutex-guarded vector that writes the eventfd on every post (what a
+// queue_in_loop from another thread does) with MpscQueue plus a wakeup only
+// when the consumer is idle (what LoopMailbox does).
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "mpscqueue.hpp"
+
+namespace
+{
+constexpr int kProducers = 10;
+constexpr int kPostsPerProducer = 200000;
+constexpr std::int64_t kTotal = static_cast<std::int64_t>(kProducers) * kPostsPerProducer;
+
+struct Result
+{
+    double seconds;
+    std::int64_t wakeups;   // eventfd writes
+    std::int64_t drains;    // times the consumer woke up to run work
+};
+
+void wake(int fd, std::atomic<std::int64_t>& wakeups)
+{
+    std::uint64_t one = 1;
+    ::write(fd, &one, sizeof(one));
+    wakeups.fetch_add(1, std::memory_order_relaxed);
+}
+
+void wait(int fd)
+{
+    pollfd pfd{ fd, POLLIN, 0 };
+    ::poll(&pfd, 1, -1);
+    std::uint64_t n;
+    ::read(fd, &n, sizeof(n));
+}
+
+template <typename Post, typename Drain>
+Result run(Post&& post, Drain&& drain, std::atomic<std::int64_t>& wakeups, int fd)
+{
+    std::int64_t done = 0, drains = 0;
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p)
+        producers.emplace_back([&] {
+            for (int i = 0; i < kPostsPerProducer; ++i) post(&done);
+        });
+
+    while (done < kTotal)
+    {
+        wait(fd);
+        ++drains;
+        drain();
+    }
+
+    for (auto &t : producers) t.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return { elapsed.count(), wakeups.load(), drains };
+}
+
+Result mutex_vector()
+{
+    const int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    std::atomic<std::int64_t> wakeups{0};
+    std::mutex mutex;
+    std::vector<std::function<void()>> pending;
+
+    auto post = [&] (std::int64_t* done) {
+        {
+            std::lock_guard lock(mutex);
+            pending.emplace_back([done] { ++*done; });
+        }
+        wake(fd, wakeups);
+    };
+    auto drain = [&] {
+        std::vector<std::function<void()>> functors;
+        {
+            std::lock_guard lock(mutex);
+            functors.swap(pending);
+        }
+        for (const auto &f : functors) f();
+    };
+
+    auto result = run(post, drain, wakeups, fd);
+    ::close(fd);
+    return result;
+}
+
+Result mpsc_coalesced()
+{
+    const int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    std::atomic<std::int64_t> wakeups{0};
+    std::atomic<bool> scheduled{false};
+    npcp::MpscQueue<std::function<void()>> queue;
+
+    auto post = [&] (std::int64_t* done) {
+        queue.push([done] { ++*done; });
+        if (!scheduled.exchange(true)) wake(fd, wakeups);
+    };
+    auto drain = [&] {
+        scheduled.exchange(false);
+        std::function<void()> f;
+        while (queue.pop(f)) f();
+    };
+
+    auto result = run(post, drain, wakeups, fd);
+    ::close(fd);
+    return result;
+}
+
+void print(const char* name, const Result& r)
+{
+    std::printf("%-28s %8.2f Mposts/s %10lld wakeups %10lld drains %8.1f posts/drain\n", name,
+        kTotal / r.seconds / 1e6,
+        static_cast<long long>(r.wakeups),
+        static_cast<long long>(r.drains),
+        static_cast<double>(kTotal) / (r.drains ? r.drains : 1));
+}
+} // namespace
+
+int main()
+{
+    std::printf("%d producers x %d posts into one consumer\n", kProducers, kPostsPerProducer);
+    print("mutex + vector", mutex_vector());
+    print("mpsc + coalesced wakeup", mpsc_coalesced());
+    return 0;
+}
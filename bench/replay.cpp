@@ -0,0 +1,332 @@
+// npcp_replay: re-drives a traffic capture (npcp --capture FILE) against a
+// server, keeping the recorded timing scaled by --speed or, with max, as
+// fast as the sockets take it.
+//
+//   npcp_replay [--host H] [--port P] [--speed 1|10|...|max] [--probe N] FILE
+//
+// Reports how far replay fell behind the recorded schedule and achieved lines
+// per second against the recording. For server latency every Nth line of a
+// registered connection (default 10, 0 turns it off) is followed by a PING;
+// lines are handled in order, so its PONG marks when the server got through
+// the lines before it. Connections that were already open when the capture
+// started are opened on their first line, so they replay unregistered.
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "ircclient.hpp"
+#include "capture.hpp"
+
+namespace
+{
+using npcp::Capture;
+using npcp::CaptureRecord;
+using npcp::bench::IrcClient;
+
+std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Connection
+{
+    std::unique_ptr<IrcClient> client;
+    bool registered = false;
+    int since_probe = 0;
+    std::deque<std::int64_t> pings;     // send times of probes, 0 for recorded PINGs
+};
+
+struct Stats
+{
+    std::int64_t lines = 0;
+    std::int64_t connects = 0;
+    std::int64_t bytes_in = 0;
+    std::int64_t errors = 0;
+    std::vector<std::int64_t> lag_ns;       // behind schedule, per line
+    std::vector<std::int64_t> probe_ns;
+};
+
+class Replayer
+{
+  public:
+    Replayer(std::string host, int port, double speed, int probe_every)
+      : host_(std::move(host)),
+        port_(port),
+        speed_(speed),
+        probe_every_(probe_every),
+        epoll_(::epoll_create1(EPOLL_CLOEXEC))
+    {
+    }
+
+    ~Replayer()
+    {
+        ::close(epoll_);
+    }
+
+    void run(const std::vector<CaptureRecord>& records);
+
+    const Stats& stats() const { return stats_; }
+
+  private:
+    Connection* open(std::uint64_t id);
+    void issue(const CaptureRecord& record, std::int64_t scheduled_ns);
+    void poll(int timeout_ms);
+
+    std::string host_;
+    int port_;
+    double speed_;                  // 0 for unbounded
+    int probe_every_;
+    int epoll_;
+    std::unordered_map<std::uint64_t, Connection> conns_;
+    std::unordered_map<int, std::uint64_t> by_fd_;
+    Stats stats_;
+};
+
+Connection* Replayer::open(std::uint64_t id)
+{
+    int fd = npcp::bench::connect_to(host_, port_);
+    if (fd < 0)
+    {
+        ++stats_.errors;
+        return nullptr;
+    }
+
+    auto &conn = conns_[id];
+    conn.client = std::make_unique<IrcClient>(fd);
+    by_fd_[fd] = id;
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.fd = fd;
+    ::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev);
+    ++stats_.connects;
+    return &conn;
+}
+
+void Replayer::issue(const CaptureRecord &record, std::int64_t scheduled_ns)
+{
+    auto it = conns_.find(record.conn);
+    Connection *conn = it == conns_.end() ? nullptr : &it->second;
+
+    switch (record.kind)
+    {
+        case Capture::kConnect:
+            if (conn == nullptr) open(record.conn);
+            break;
+
+        case Capture::kLine:
+        {
+            if (conn == nullptr && (conn = open(record.conn)) == nullptr) break;
+            const auto now = now_ns();
+            if (speed_ > 0) stats_.lag_ns.push_back(std::max<std::int64_t>(now - scheduled_ns, 0));
+            conn->client->queue(record.line);
+            if (conn->registered)
+            {
+                if (record.line.compare(0, 5, "PING ") == 0) conn->pings.push_back(0);
+                if (probe_every_ > 0 && ++conn->since_probe >= probe_every_)
+                {
+                    conn->client->queue("PING replay\r\n");
+                    conn->pings.push_back(now);
+                    conn->since_probe = 0;
+                }
+            }
+            conn->client->flush();
+            ++stats_.lines;
+            break;
+        }
+
+        case Capture::kDisconnect:
+            if (conn)
+            {
+                by_fd_.erase(conn->client->fd());
+                conns_.erase(it);
+            }
+            break;
+    }
+}
+
+void Replayer::poll(int timeout_ms)
+{
+    epoll_event events[256];
+    int n = ::epoll_wait(epoll_, events, 256, timeout_ms);
+    for (int i = 0; i < n; ++i)
+    {
+        auto fd_it = by_fd_.find(events[i].data.fd);
+        if (fd_it == by_fd_.end()) continue;
+        auto &conn = conns_[fd_it->second];
+
+        if (events[i].events & EPOLLOUT) conn.client->flush();
+        if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+
+        const bool open = conn.client->read_lines([&] (std::string_view line) {
+            stats_.bytes_in += line.size() + 2;
+            if (line.find(" 001 ") != std::string_view::npos)
+            {
+                conn.registered = true;
+            }
+            else if (line.find(" PONG ") != std::string_view::npos && !conn.pings.empty())
+            {
+                if (conn.pings.front()) stats_.probe_ns.push_back(now_ns() - conn.pings.front());
+                conn.pings.pop_front();
+            }
+        });
+        if (!open)
+        {
+            // the server closed it, normally after a QUIT
+            by_fd_.erase(fd_it);
+            conn.client->close();
+        }
+    }
+}
+
+void Replayer::run(const std::vector<CaptureRecord> &records)
+{
+    if (records.empty()) return;
+
+    const auto origin_us = records.front().time_us;
+    const auto start = now_ns();
+    std::size_t next = 0;
+
+    while (next < records.size())
+    {
+        if (speed_ <= 0)
+        {
+            // unbounded: a batch at a time, reading replies in between
+            for (std::size_t end = std::min(next + 1024, records.size()); next < end; ++next)
+                issue(records[next], 0);
+            poll(0);
+            continue;
+        }
+
+        const auto now = now_ns();
+        auto due = [&] (const CaptureRecord& r) {
+            return start + static_cast<std::int64_t>((r.time_us - origin_us) * 1000 / speed_);
+        };
+        while (next < records.size() && due(records[next]) <= now)
+        {
+            issue(records[next], due(records[next]));
+            ++next;
+        }
+
+        int timeout_ms = 10;
+        if (next < records.size())
+            timeout_ms = static_cast<int>(std::clamp<std::int64_t>((due(records[next]) - now) / 1000000, 0, 10));
+        poll(timeout_ms);
+    }
+
+    // drain replies until the server has been quiet for a second
+    auto last = stats_.bytes_in;
+    for (auto quiet = now_ns(); now_ns() - quiet < 1000000000; )
+    {
+        poll(10);
+        if (stats_.bytes_in != last)
+        {
+            last = stats_.bytes_in;
+            quiet = now_ns();
+        }
+    }
+}
+
+double percentile_ms(std::vector<std::int64_t>& v, double q)
+{
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[static_cast<std::size_t>(q * (v.size() - 1))] / 1e6;
+}
+
+void usage(const char* argv0)
+{
+    std::fprintf(stderr, "usage: %s [--host H] [--port P] [--speed 1|10|...|max] [--probe N] capture-file\n", argv0);
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string host = "127.0.0.1", path;
+    int port = 7776;
+    double speed = 1;
+    int probe_every = 10;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--host") == 0 && i + 1 < argc) host = argv[++i];
+        else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) port = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+        {
+            ++i;
+            speed = std::strcmp(argv[i], "max") == 0 ? 0 : std::atof(argv[i]);
+        }
+        else if (std::strcmp(argv[i], "--probe") == 0 && i + 1 < argc) probe_every = std::atoi(argv[++i]);
+        else if (argv[i][0] != '-' && path.empty()) path = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (path.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    npcp::CaptureReader reader(path);
+    if (!reader.is_open())
+    {
+        std::fprintf(stderr, "%s is not a capture file\n", path.c_str());
+        return 1;
+    }
+
+    std::vector<CaptureRecord> records;
+    for (CaptureRecord r; reader.next(r); ) records.push_back(r);
+    std::stable_sort(records.begin(), records.end(),
+        [] (const CaptureRecord& a, const CaptureRecord& b) { return a.time_us < b.time_us; });
+    if (records.empty())
+    {
+        std::fprintf(stderr, "%s holds no records\n", path.c_str());
+        return 1;
+    }
+
+    const double recorded_s = (records.back().time_us - records.front().time_us) / 1e6;
+    const auto recorded_lines = std::count_if(records.begin(), records.end(),
+        [] (const CaptureRecord& r) { return r.kind == Capture::kLine; });
+
+    Replayer replayer(host, port, speed, probe_every);
+    const auto start = now_ns();
+    replayer.run(records);
+    // the final second of draining isn't replay time
+    const double replay_s = std::max((now_ns() - start) / 1e9 - 1.0, 1e-9);
+
+    auto stats = replayer.stats();
+    std::printf("recorded: %lld lines over %.2fs (%.0f lines/s)\n",
+        static_cast<long long>(recorded_lines), recorded_s,
+        recorded_s > 0 ? recorded_lines / recorded_s : 0.0);
+    if (speed > 0) std::printf("replayed at %gx: ", speed);
+    else std::printf("replayed unbounded: ");
+    std::printf("%lld lines over %.2fs (%.0f lines/s), %lld connections, %lld bytes back, %lld errors\n",
+        static_cast<long long>(stats.lines), replay_s, stats.lines / replay_s,
+        static_cast<long long>(stats.connects), static_cast<long long>(stats.bytes_in),
+        static_cast<long long>(stats.errors));
+    if (speed > 0)
+        std::printf("behind schedule: p50 %.3fms  p99 %.3fms  max %.3fms  (ideal span %.2fs)\n",
+            percentile_ms(stats.lag_ns, 0.5), percentile_ms(stats.lag_ns, 0.99),
+            percentile_ms(stats.lag_ns, 1.0), recorded_s / speed);
+    if (probe_every > 0)
+        std::printf("probe latency: p50 %.3fms  p99 %.3fms  p999 %.3fms  (%zu probes)\n",
+            percentile_ms(stats.probe_ns, 0.5), percentile_ms(stats.probe_ns, 0.99),
+            percentile_ms(stats.probe_ns, 0.999), stats.probe_ns.size());
+    return stats.errors ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+#include <pthread.h>
+#include <sched.h>
+#include <cstdlib>
+
+#include "affinity.hpp"
+
+namespace npcp
+{
+std::vector<int> parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus;
+    const char *p = list.c_str();
+    while (*p)
+    {
+        char *end;
+        const long first = std::strtol(p, &end, 10);
+        if (end == p || first < 0) return {};
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = std::strtol(++p, &end, 10);
+            if (end == p || last < first) return {};
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) cpus.push_back(static_cast<int>(cpu));
+
+        if (*p == ',') ++p;
+        else if (*p) return {};
+    }
+    return cpus;
+}
+
+bool pin_current_thread(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+} // namespace npcp
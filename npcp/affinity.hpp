@@ -0,0 +1,17 @@
+#ifndef NPCP_AFFINITY_HPP
+#define NPCP_AFFINITY_HPP
+
+#include <string>
+#include <vector>
+
+namespace npcp
+{
+// "0-3,8,10-11" as {0, 1, 2, 3, 8, 10, 11}; empty if the list is malformed
+std::vector<int> parse_cpu_list(const std::string& list);
+
+// binds the calling thread to one CPU; false if the kernel refused
+bool pin_current_thread(int cpu);
+
+} // namespace npcp
+
+#endif // NPCP_AFFINITY_HPP
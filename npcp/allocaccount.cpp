@@ -0,0 +1,61 @@
+#ifdef NPCP_ALLOC_ACCOUNTING
+
+#include <new>
+#include <cstdlib>
+
+#include "allocaccount.hpp"
+#include "metrics.hpp"
+
+namespace
+{
+// plain pointers, so reading them from operator new needs no TLS init call
+// and can't itself allocate
+thread_local npcp::metrics::Counter* t_count = nullptr;
+thread_local npcp::metrics::Counter* t_bytes = nullptr;
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    if (t_count)
+    {
+        t_count->add();
+        t_bytes->add(static_cast<std::int64_t>(size));
+    }
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace npcp
+{
+namespace allocaccount
+{
+Tag::Tag(std::size_t command)
+  : count_(t_count),
+    bytes_(t_bytes)
+{
+    // local() may register the shard, so look it up before the tag is live
+    auto &shard = metrics::local();
+    t_count = &shard.command_allocs[command];
+    t_bytes = &shard.command_alloc_bytes[command];
+}
+
+Tag::~Tag()
+{
+    t_count = count_;
+    t_bytes = bytes_;
+}
+
+} // namespace allocaccount
+} // namespace npcp
+
+#endif // NPCP_ALLOC_ACCOUNTING
@@ -0,0 +1,48 @@
+#ifndef NPCP_ALLOCACCOUNT_HPP
+#define NPCP_ALLOCACCOUNT_HPP
+
+#include <cstddef>
+
+namespace npcp
+{
+namespace metrics
+{
+class Counter;
+} // namespace metrics
+
+namespace allocaccount
+{
+// Configured with -DNPCP_ALLOC_ACCOUNTING=ON, allocaccount.cpp replaces the
+// global operator new and charges every allocation a thread makes while a Tag
+// is alive to that command, in the thread's metrics shard. Otherwise Tag
+// compiles away and operator new is the library's.
+#ifdef NPCP_ALLOC_ACCOUNTING
+constexpr bool kEnabled = true;
+
+class Tag
+{
+  public:
+    explicit Tag(std::size_t command);
+    ~Tag();
+
+    Tag(const Tag&) = delete;
+    Tag& operator=(const Tag&) = delete;
+
+  private:
+    metrics::Counter* count_;
+    metrics::Counter* bytes_;
+};
+#else
+constexpr bool kEnabled = false;
+
+class Tag
+{
+  public:
+    explicit Tag(std::size_t) {}
+};
+#endif
+
+} // namespace allocaccount
+} // namespace npcp
+
+#endif // NPCP_ALLOCACCOUNT_HPP
@@ -0,0 +1,149 @@
+#include <algorithm>
+
+#include "capture.hpp"
+#include "metrics.hpp"
+
+namespace
+{
+const char kMagic[8] = { 'N', 'P', 'C', 'P', 'C', 'A', 'P', '1' };
+constexpr std::size_t kChunkBytes = 64 * 1024;
+constexpr std::int64_t kChunkAgeNs = 1000000000;
+
+void put_varint(std::string& out, std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+} // namespace
+
+namespace npcp
+{
+// One per I/O thread; the chunk is handed to the file when it fills up, gets
+// old, or the thread exits.
+struct Capture::ThreadBuffer
+{
+    ~ThreadBuffer()
+    {
+        if (owner) owner->retire(this);
+    }
+
+    Capture* owner = nullptr;
+    std::string chunk;
+    std::int64_t first_ns = 0;
+};
+
+Capture::Capture(const std::string &path)
+  : start_ns_(metrics::now_ns()),
+    out_(path, std::ios::binary | std::ios::trunc)
+{
+    if (out_) out_.write(kMagic, sizeof(kMagic));
+}
+
+Capture::~Capture()
+{
+    std::lock_guard lock(mutex_);
+    for (auto *buffer : buffers_)
+    {
+        out_.write(buffer->chunk.data(), buffer->chunk.size());
+        buffer->chunk.clear();
+        buffer->owner = nullptr;
+    }
+    out_.flush();
+}
+
+void Capture::retire(ThreadBuffer *buffer)
+{
+    std::lock_guard lock(mutex_);
+    out_.write(buffer->chunk.data(), buffer->chunk.size());
+    out_.flush();
+    buffer->chunk.clear();
+    buffer->owner = nullptr;
+    buffers_.erase(std::find(buffers_.begin(), buffers_.end(), buffer));
+}
+
+void Capture::record(Kind kind, std::uint64_t conn, std::string_view line)
+{
+    thread_local ThreadBuffer buffer;
+    if (buffer.owner != this)
+    {
+        if (buffer.owner) buffer.owner->retire(&buffer);
+        std::lock_guard lock(mutex_);
+        buffers_.push_back(&buffer);
+        buffer.owner = this;
+    }
+
+    const auto now = metrics::now_ns();
+    if (buffer.chunk.empty()) buffer.first_ns = now;
+
+    auto &chunk = buffer.chunk;
+    put_varint(chunk, static_cast<std::uint64_t>(now - start_ns_) / 1000);
+    put_varint(chunk, conn);
+    chunk.push_back(kind);
+    if (kind == kLine)
+    {
+        put_varint(chunk, line.size());
+        chunk.append(line);
+    }
+
+    if (chunk.size() >= kChunkBytes || now - buffer.first_ns >= kChunkAgeNs)
+        write(chunk);
+}
+
+void Capture::write(std::string &chunk)
+{
+    {
+        std::lock_guard lock(mutex_);
+        out_.write(chunk.data(), chunk.size());
+        out_.flush();
+    }
+    chunk.clear();
+}
+
+CaptureReader::CaptureReader(const std::string &path)
+  : in_(path, std::ios::binary),
+    ok_(false)
+{
+    char magic[sizeof(kMagic)];
+    if (in_.read(magic, sizeof(magic)))
+        ok_ = std::equal(magic, magic + sizeof(magic), kMagic);
+}
+
+bool CaptureReader::varint(std::uint64_t &value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        const int c = in_.get();
+        if (c == std::char_traits<char>::eof()) return false;
+        value |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+bool CaptureReader::next(CaptureRecord &record)
+{
+    std::uint64_t time_us, len;
+    if (!ok_ || !varint(time_us) || !varint(record.conn)) return false;
+
+    const int kind = in_.get();
+    if (kind != Capture::kConnect && kind != Capture::kLine && kind != Capture::kDisconnect)
+        return false;
+    record.time_us = static_cast<std::int64_t>(time_us);
+    record.kind = static_cast<Capture::Kind>(kind);
+    record.line.clear();
+
+    if (record.kind == Capture::kLine)
+    {
+        if (!varint(len)) return false;
+        record.line.resize(len);
+        if (!in_.read(record.line.data(), len)) return false;
+    }
+    return true;
+}
+
+} // namespace npcp
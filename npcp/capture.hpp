@@ -0,0 +1,85 @@
+#ifndef NPCP_CAPTURE_HPP
+#define NPCP_CAPTURE_HPP
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <string_view>
+
+namespace npcp
+{
+// Binary log of inbound traffic as on_message sees it, replayed by
+// bench/replay.cpp. The file is the magic "NPCPCAP1" followed by records:
+//
+//   varint  microseconds since the capture started
+//   varint  connection (the client's Handle)
+//   byte    kind: 'C' connected, 'L' line, 'D' disconnected
+//   varint  length, then the line with its CRLF       (lines only)
+//
+// Each I/O thread fills a buffer of its own and appends it to the file about
+// once a second, so records are ordered within a chunk but chunks of different
+// threads interleave; readers sort by time. Buffers still holding records
+// are written out when their thread exits or the Capture is destroyed.
+class Capture
+{
+  public:
+    enum Kind : char
+    {
+        kConnect = 'C',
+        kLine = 'L',
+        kDisconnect = 'D'
+    };
+
+    explicit Capture(const std::string& path);
+    ~Capture();
+
+    Capture(const Capture&) = delete;
+    Capture& operator=(const Capture&) = delete;
+
+    bool is_open() const { return out_.is_open(); }
+
+    void record(Kind kind, std::uint64_t conn, std::string_view line = {});
+
+  private:
+    struct ThreadBuffer;
+
+    void write(std::string& chunk);
+    void retire(ThreadBuffer* buffer);
+
+    std::int64_t start_ns_;
+    std::mutex mutex_;
+    std::ofstream out_;
+    std::vector<ThreadBuffer*> buffers_;
+};
+
+struct CaptureRecord
+{
+    std::int64_t time_us;
+    std::uint64_t conn;
+    Capture::Kind kind;
+    std::string line;
+};
+
+class CaptureReader
+{
+  public:
+    explicit CaptureReader(const std::string& path);
+
+    // false if the file couldn't be opened or isn't a capture
+    bool is_open() const { return ok_; }
+
+    // false at the end of the file or at a truncated record
+    bool next(CaptureRecord& record);
+
+  private:
+    bool varint(std::uint64_t& value);
+
+    std::ifstream in_;
+    bool ok_;
+};
+
+} // namespace npcp
+
+#endif // NPCP_CAPTURE_HPP
@@ -0,0 +1,178 @@
+#include <chrono>
+#include <algorithm>
+
+#include "directory.hpp"
+
+namespace npcp
+{
+Directory::Directory(std::size_t workers)
+  : applier_idle_(false),
+    applier_stopping_(false),
+    tables_(std::make_shared<Tables>()),
+    workers_stopping_(false)
+{
+    applier_ = std::thread([this] { this->apply(); });
+    for (std::size_t i = 0; i < workers; ++i)
+        workers_.emplace_back([this] { this->work(); });
+}
+
+Directory::~Directory()
+{
+    {
+        std::lock_guard lock(applier_mutex_);
+        applier_stopping_ = true;
+    }
+    applier_cond_.notify_all();
+    applier_.join();
+
+    {
+        std::lock_guard lock(work_mutex_);
+        workers_stopping_ = true;
+    }
+    work_cond_.notify_all();
+    for (auto &worker : workers_) worker.join();
+}
+
+void Directory::update_user(Handle handle, User user)
+{
+    push({ Change::kUser, handle, std::string(), std::make_shared<const User>(std::move(user)), {}, std::string(), nullptr });
+}
+
+void Directory::remove_user(Handle handle)
+{
+    push({ Change::kUser, handle, std::string(), nullptr, {}, std::string(), nullptr });
+}
+
+void Directory::add_member(const std::string &channel, Member member)
+{
+    push({ Change::kAddMember, member.handle, channel, nullptr, member, std::string(), nullptr });
+}
+
+void Directory::remove_member(const std::string &channel, Handle handle)
+{
+    push({ Change::kRemoveMember, handle, channel, nullptr, {}, std::string(), nullptr });
+}
+
+void Directory::update_member(const std::string &channel, Member member)
+{
+    push({ Change::kUpdateMember, member.handle, channel, nullptr, member, std::string(), nullptr });
+}
+
+void Directory::set_topic(const std::string &channel, std::string topic)
+{
+    push({ Change::kTopic, kNullHandle, channel, nullptr, {}, std::move(topic), nullptr });
+}
+
+void Directory::query(Query query)
+{
+    push({ Change::kQuery, kNullHandle, std::string(), nullptr, {}, std::string(), std::move(query) });
+}
+
+void Directory::push(Change change)
+{
+    changes_.push(std::move(change));
+    // pairs with the fence in apply(): either the applier sees the change or
+    // we see that it went to sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (applier_idle_.exchange(false))
+    {
+        std::lock_guard lock(applier_mutex_);
+        applier_cond_.notify_one();
+    }
+}
+
+void Directory::apply()
+{
+    Change change;
+    for (;;)
+    {
+        if (!changes_.pop(change))
+        {
+            std::unique_lock lock(applier_mutex_);
+            applier_idle_.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!changes_.pop(change))
+            {
+                if (applier_stopping_) return;
+                applier_cond_.wait_for(lock, std::chrono::milliseconds(100));
+                applier_idle_.store(false);
+                continue;
+            }
+            applier_idle_.store(false);
+        }
+
+        if (change.kind == Change::kQuery)
+        {
+            std::shared_ptr<const Tables> snapshot = tables_;
+            {
+                std::lock_guard lock(work_mutex_);
+                work_.push_back([snapshot, query = std::move(change.query)] { query(*snapshot); });
+            }
+            work_cond_.notify_one();
+            continue;
+        }
+
+        // copy on write: a worker still reading these tables keeps its copy
+        if (tables_.use_count() > 1) tables_ = std::make_shared<Tables>(*tables_);
+
+        if (change.kind != Change::kUser)
+            apply_channel(change);
+        else if (change.user)
+            tables_->users[change.handle] = std::move(change.user);
+        else
+            tables_->users.erase(change.handle);
+    }
+}
+
+void Directory::apply_channel(Change &change)
+{
+    auto it = tables_->channels.find(change.name);
+    if (it == tables_->channels.end())
+    {
+        // nothing but a first member brings a channel into being
+        if (change.kind != Change::kAddMember) return;
+        it = tables_->channels.emplace(change.name, std::make_shared<Channel>()).first;
+    }
+    // copy on write again, a worker's snapshot may share this channel; the
+    // applier only ever creates them non-const, so it may change its own
+    if (it->second.use_count() > 1) it->second = std::make_shared<Channel>(*it->second);
+    auto &channel = const_cast<Channel&>(*it->second);
+
+    auto &members = channel.members;
+    auto member = std::find_if(members.begin(), members.end(),
+        [&change] (const Member& m) { return m.handle == change.handle; });
+    switch (change.kind)
+    {
+        case Change::kAddMember:
+            if (member == members.end()) members.push_back(change.member);
+            break;
+        case Change::kRemoveMember:
+            if (member != members.end()) members.erase(member);
+            if (members.empty()) tables_->channels.erase(it);
+            break;
+        case Change::kUpdateMember:
+            if (member != members.end()) *member = change.member;
+            break;
+        default:
+            channel.topic = std::move(change.topic);
+            break;
+    }
+}
+
+void Directory::work()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(work_mutex_);
+            work_cond_.wait(lock, [this] { return workers_stopping_ || !work_.empty(); });
+            if (workers_stopping_) return;
+            task = std::move(work_.front());
+            work_.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace npcp
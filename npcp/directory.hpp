@@ -0,0 +1,119 @@
+#ifndef NPCP_DIRECTORY_HPP
+#define NPCP_DIRECTORY_HPP
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "mpscqueue.hpp"
+#include "slottable.hpp"
+
+namespace npcp
+{
+// A copy of the user and channel tables for queries that walk all of them,
+// kept off the I/O loops. Loops push updates onto a lock-free queue, whole
+// users but only what changed of a channel, and one applier thread folds
+// them in, in order; a query is queued
+// the same way, so it sees every change pushed before it, its own loop's
+// included. Queries then run on a worker pool against an immutable
+// snapshot: the applier hands out its current tables and clones them only
+// when a change arrives while a worker still holds them. Writers never
+// wait for readers, and readers never see a half-applied change.
+class Directory
+{
+  public:
+    struct User
+    {
+        std::string nick;
+        std::string username;
+        std::string realname;
+        bool away;
+        bool oper;
+    };
+
+    struct Member
+    {
+        Handle handle;
+        bool chanop;
+        bool voice;
+    };
+
+    struct Channel
+    {
+        std::string topic;
+        std::vector<Member> members;
+    };
+
+    struct Tables
+    {
+        std::unordered_map<Handle, std::shared_ptr<const User>> users;
+        std::unordered_map<std::string, std::shared_ptr<const Channel>> channels;
+    };
+
+    using Query = std::function<void(const Tables&)>;
+
+    explicit Directory(std::size_t workers);
+    ~Directory();
+
+    Directory(const Directory&) = delete;
+    Directory& operator=(const Directory&) = delete;
+
+    // any thread; changes to one channel must be pushed in the order they
+    // were made
+    void update_user(Handle handle, User user);
+    void remove_user(Handle handle);
+    // the first member added creates the channel and removing the last one
+    // drops it
+    void add_member(const std::string& channel, Member member);
+    void remove_member(const std::string& channel, Handle handle);
+    // new chanop and voice of a member
+    void update_member(const std::string& channel, Member member);
+    void set_topic(const std::string& channel, std::string topic);
+    void query(Query query);
+
+  private:
+    struct Change
+    {
+        enum Kind { kUser, kAddMember, kRemoveMember, kUpdateMember, kTopic, kQuery } kind;
+        Handle handle;                              // of the user or member
+        std::string name;                           // of the channel
+        std::shared_ptr<const User> user;           // null removes the user
+        Member member;                              // added or updated
+        std::string topic;
+        Query query;
+    };
+
+    void push(Change change);
+    void apply();
+    // a channel change on the applier thread, copying only that channel if
+    // a snapshot still holds it
+    void apply_channel(Change& change);
+    void work();
+
+    MpscQueue<Change> changes_;
+    std::atomic<bool> applier_idle_;
+    std::mutex applier_mutex_;
+    std::condition_variable applier_cond_;
+    bool applier_stopping_;             // guarded by applier_mutex_
+
+    std::shared_ptr<Tables> tables_;    // applier thread only
+
+    std::mutex work_mutex_;
+    std::condition_variable work_cond_;
+    std::deque<std::function<void()>> work_;
+    bool workers_stopping_;             // guarded by work_mutex_
+
+    std::thread applier_;
+    std::vector<std::thread> workers_;
+};
+
+} // namespace npcp
+
+#endif // NPCP_DIRECTORY_HPP
@@ -0,0 +1,22 @@
+#ifndef NPCP_HASH_HPP
+#define NPCP_HASH_HPP
+
+#include <cstddef>
+
+namespace npcp
+{
+// Command names are dispatched by switching on this hash, the literal form
+// being usable as a case label.
+constexpr std::size_t cal_hash(const char* str)
+{
+    return (*str == '\0') ? 0 : ((cal_hash(str + 1) * 201314 + *str) % 5201314);
+}
+
+constexpr std::size_t operator""_hash(const char* str, std::size_t)
+{
+    return cal_hash(str);
+}
+
+} // namespace npcp
+
+#endif // NPCP_HASH_HPP
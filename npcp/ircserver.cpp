@@ -1,5 +1,9 @@
 #include <set>
+#include <chrono>
 #include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <algorithm>
 #include <filesystem>
@@ -7,64 +11,271 @@
 #include "ircserver.hpp"
 #include "rplfuncs.hpp"
 #include "message.hpp"
+#include "metrics.hpp"
+#include "allocaccount.hpp"
+#include "trace.hpp"
+#include "memusage.hpp"
+#include "affinity.hpp"
+#include "hash.hpp"
 
-#include "../icarus/icarus/buffer.hpp"
-#include "../icarus/icarus/tcpserver.hpp"
-#include "../icarus/icarus/tcpconnection.hpp"
+#include "icarus/buffer.hpp"
+#include "icarus/tcpserver.hpp"
+#include "icarus/tcpconnection.hpp"
 
 namespace fs = std::filesystem;
+namespace metrics = npcp::metrics;
+using npcp::operator""_hash;
 
 namespace
 {
-constexpr std::size_t cal_hash(const char* str)
+metrics::Command to_command(std::size_t hs)
 {
-    return (*str == '\0') ? 0 : ((cal_hash(str + 1) * 201314 + *str) % 5201314);
+    switch (hs)
+    {
+        case "NICK"_hash:    return metrics::kNick;
+        case "USER"_hash:    return metrics::kUser;
+        case "QUIT"_hash:    return metrics::kQuit;
+        case "PRIVMSG"_hash: return metrics::kPrivmsg;
+        case "NOTICE"_hash:  return metrics::kNotice;
+        case "PING"_hash:    return metrics::kPing;
+        case "PONG"_hash:    return metrics::kPong;
+        case "MOTD"_hash:    return metrics::kMotd;
+        case "LUSERS"_hash:  return metrics::kLusers;
+        case "WHOIS"_hash:   return metrics::kWhois;
+        case "OPER"_hash:    return metrics::kOper;
+        case "MODE"_hash:    return metrics::kMode;
+        case "JOIN"_hash:    return metrics::kJoin;
+        case "PART"_hash:    return metrics::kPart;
+        case "TOPIC"_hash:   return metrics::kTopic;
+        case "AWAY"_hash:    return metrics::kAway;
+        case "NAMES"_hash:   return metrics::kNames;
+        case "LIST"_hash:    return metrics::kList;
+        case "WHO"_hash:     return metrics::kWho;
+        case "STATS"_hash:   return metrics::kStats;
+        case "SLOWLOG"_hash: return metrics::kSlowlog;
+        case "TRACEDUMP"_hash: return metrics::kTracedump;
+        default:             return metrics::kUnknown;
+    }
 }
 
-constexpr std::size_t operator""_hash(const char* str, std::size_t)
+// The connections of the loop running on this thread. A connection is
+// added, looked up and removed only on its own loop, so reads find their
+// client without a lock.
+thread_local std::unordered_map<const icarus::TcpConnection*, npcp::Handle> t_conn_handle;
+
+// Who a fan-out has reached so far: a stamp per client slot and a fresh
+// epoch per fan-out, so nothing is cleared in between. One per thread, so
+// loops fanning out over the same clients at once don't mark each other's.
+class VisitMarks
 {
-    return cal_hash(str);
+  public:
+    void begin()
+    {
+        if (++epoch_ == 0)
+        {
+            std::fill(stamps_.begin(), stamps_.end(), 0);
+            epoch_ = 1;
+        }
+    }
+
+    // true the first time handle comes up since begin()
+    bool first_visit(npcp::Handle handle)
+    {
+        const auto index = static_cast<std::uint32_t>(handle);
+        if (index >= stamps_.size()) stamps_.resize(index + 1024, 0);
+        if (stamps_[index] == epoch_) return false;
+        stamps_[index] = epoch_;
+        return true;
+    }
+
+  private:
+    std::vector<std::uint32_t> stamps_;
+    std::uint32_t epoch_ = 0;
+};
+
+thread_local VisitMarks t_visits;
+
+// a line as a capture file keeps it: with passwords replaced, so the file
+// can be shared and replay still issues the command
+std::string captured_line(const npcp::Message& msg)
+{
+    const auto &command = msg.command();
+    const auto &args = msg.args();
+    if (command == "PASS")
+        return "PASS <hidden>\r\n";
+    if (command == "OPER" && args.size() >= 2)
+        return "OPER " + args[0] + " <hidden>\r\n";
+    return msg.raw();
 }
 
 constexpr uint32_t kChannelMode_m = 0b1;
 constexpr uint32_t kChannelMode_t = 0b10;
-constexpr uint32_t kChannelMode_v = 0x100;
+
+// a Client's modes word
+constexpr uint32_t kUserMode_o = 0b1;
+constexpr uint32_t kUserMode_a = 0b10;
+
+// Modes MODE understands. A channel mode with no flag is a member status
+// that takes a nick and lives in ChannelInfo's operators or voices.
+struct ChannelModeSpec
+{
+    char letter;
+    uint32_t flag;
+};
+
+constexpr ChannelModeSpec kChannelModes[] = {
+    { 'm', kChannelMode_m },
+    { 't', kChannelMode_t },
+    { 'o', 0 },
+    { 'v', 0 },
+};
+
+struct UserModeSpec
+{
+    char letter;
+    uint32_t flag;
+};
+
+constexpr UserModeSpec kUserModes[] = {
+    { 'o', kUserMode_o },
+    { 'a', kUserMode_a },
+};
+
+// member status changes taken from one MODE, the rest are ignored
+constexpr std::size_t kMaxModeTargets = 12;
+
+// targets of one PRIVMSG or NOTICE; JOIN and PART take as many channels as
+// fit on a line
+constexpr std::size_t kMaxTextTargets = 4;
+
+// the entries of a comma-separated target list, each once; none if it is
+// only commas
+std::vector<std::string> split_targets(const std::string& list)
+{
+    std::vector<std::string> targets;
+    for (std::size_t begin = 0, end; begin <= list.size(); begin = end + 1)
+    {
+        end = std::min(list.find(',', begin), list.size());
+        if (end == begin) continue;
+        auto target = list.substr(begin, end - begin);
+        if (std::find(targets.begin(), targets.end(), target) == targets.end())
+            targets.push_back(std::move(target));
+    }
+    return targets;
+}
+
+const std::string& isupport_tokens()
+{
+    static const std::string tokens =
+        "CHANTYPES=# PREFIX=(ov)@+ CHANMODES=,,,mt MODES=" + std::to_string(kMaxModeTargets) +
+        " TARGMAX=JOIN:,PART:,PRIVMSG:" + std::to_string(kMaxTextTargets) +
+        ",NOTICE:" + std::to_string(kMaxTextTargets);
+    return tokens;
+}
+
+const ChannelModeSpec* channel_mode(char letter)
+{
+    for (const auto &spec : kChannelModes)
+        if (spec.letter == letter) return &spec;
+    return nullptr;
+}
+
+const UserModeSpec* user_mode(char letter)
+{
+    for (const auto &spec : kUserModes)
+        if (spec.letter == letter) return &spec;
+    return nullptr;
+}
 
 std::string channel_mode_to_string(uint32_t mode)
 {
     std::string str_mode("+");
-    if (mode & kChannelMode_m)
-        str_mode.push_back('m');
-    if (mode & kChannelMode_t)
-        str_mode.push_back('t');
-    if (mode & kChannelMode_v)
-        str_mode.push_back('v');
+    for (const auto &spec : kChannelModes)
+        if (mode & spec.flag) str_mode.push_back(spec.letter);
     return str_mode;
 }
 
-inline void set_channel_mode(uint32_t& mode, uint32_t mask)
+inline bool channel_mode_m(uint32_t mode)
 {
-    mode |= mask;
+    return mode & kChannelMode_m;
 }
 
-inline void unset_channel_mode(uint32_t& mode, uint32_t mask)
+inline bool channel_mode_t(uint32_t mode)
 {
-    mode &= ~mask;
+    return mode & kChannelMode_t;
 }
 
-inline bool channel_mode_m(uint32_t mode)
+// listings over the whole server, built on a query worker from a directory
+// snapshot; emit takes one reply line at a time
+using Tables = npcp::Directory::Tables;
+
+constexpr std::size_t kReplyChunk = 16 * 1024;
+
+// cached NAMES lines leave room for a requesting nick this long, longer
+// ones get theirs rendered afresh
+constexpr std::size_t kNamesNickRoom = 30;
+
+template <typename Emit>
+void list_all(const Tables& tables, const std::string& nick, Emit&& emit)
 {
-    return mode & kChannelMode_m;
+    for (const auto &[name, channel] : tables.channels)
+        emit(npcp::reply::rpl_list(nick, name, channel->members.size(), channel->topic));
+    emit(npcp::reply::rpl_listend(nick));
 }
 
-inline bool channel_mode_v(uint32_t mode)
+template <typename Emit>
+void names_all(const Tables& tables, const std::string& nick, Emit&& emit)
 {
-    return mode & kChannelMode_v;
+    std::set<std::string> lone;     // in no channel
+    for (const auto &entry : tables.users) lone.insert(entry.second->nick);
+
+    std::vector<std::string> names;
+    for (const auto &[name, channel] : tables.channels)
+    {
+        names.clear();
+        for (const auto &member : channel->members)
+        {
+            auto it = tables.users.find(member.handle);
+            if (it == tables.users.end()) continue;
+            const auto &peer = it->second->nick;
+            names.push_back(member.chanop ? "@" + peer : member.voice ? "+" + peer : peer);
+            lone.erase(peer);
+        }
+        emit(npcp::reply::rpl_namreply(nick, name, names));
+    }
+    if (!lone.empty()) emit(npcp::reply::rpl_namreply(
+        nick, "*", std::vector<std::string>(lone.begin(), lone.end())
+    ));
+    emit(npcp::reply::rpl_endofnames(nick, "*"));
 }
 
-inline bool channel_mode_t(uint32_t mode)
+template <typename Emit>
+void who_all(const Tables& tables, const std::string& nick, npcp::Handle self, Emit&& emit)
 {
-    return mode & kChannelMode_t;
+    // everyone who shares no channel with the asker, by nick
+    std::set<npcp::Handle> shared;
+    for (const auto &entry : tables.channels)
+    {
+        const auto &members = entry.second->members;
+        auto is_self = [self] (const npcp::Directory::Member& m) { return m.handle == self; };
+        if (std::none_of(members.begin(), members.end(), is_self)) continue;
+        for (const auto &member : members) shared.insert(member.handle);
+    }
+
+    std::vector<const npcp::Directory::User*> users;
+    for (const auto &[handle, user] : tables.users)
+        if (!shared.count(handle)) users.push_back(user.get());
+    std::sort(users.begin(), users.end(), [] (const auto* a, const auto* b) { return a->nick < b->nick; });
+
+    for (const auto *user : users)
+    {
+        std::string flags = user->away ? "G" : "H";
+        if (user->oper) flags += "*";
+        emit(npcp::reply::rpl_whoreply(
+            nick, "*", user->username, "jusot.com", "jusot.com",
+            user->nick, flags, user->realname));
+    }
+    emit(npcp::reply::rpl_endofwho(nick, "*"));
 }
 
 } // namespace
@@ -74,7 +285,16 @@ namespace npcp
 using namespace icarus;
 
 IrcServer::IrcServer(EventLoop *loop, const InetAddress &listen_addr, std::string name)
-  : server_(loop, listen_addr, std::move(name))
+  : oper_password_("foobar"),
+    shed_lag_ns_(50000000),
+    line_budget_(64),
+    isupport_(false),
+    channel_count_(0),
+    loop_(loop),
+    next_cpu_(0),
+    slowlog_(128, 10000000),
+    slowlog_path_("./slowlog.txt"),
+    server_(loop, listen_addr, std::move(name))
 {
     server_.set_connection_callback([this] (const TcpConnectionPtr& conn) {
         this->on_connection(conn);
@@ -85,920 +305,1464 @@ IrcServer::IrcServer(EventLoop *loop, const InetAddress &listen_addr, std::strin
     server_.set_thread_num(10);
 }
 
+void IrcServer::set_thread_num(int threads)
+{
+    server_.set_thread_num(threads);
+}
+
+void IrcServer::set_cpu_affinity(std::vector<int> cpus)
+{
+    cpus_ = std::move(cpus);
+}
+
+void IrcServer::set_oper_password(std::string password)
+{
+    oper_password_ = std::move(password);
+}
+
+void IrcServer::set_shed_lag(std::int64_t lag_ms)
+{
+    shed_lag_ns_ = lag_ms * 1000000;
+}
+
+void IrcServer::set_line_budget(std::size_t lines)
+{
+    line_budget_ = lines;
+}
+
+void IrcServer::set_isupport(bool advertise)
+{
+    isupport_ = advertise;
+}
+
+void IrcServer::set_query_threads(std::size_t threads)
+{
+    directory_.reset();
+    if (threads) directory_ = std::make_unique<Directory>(threads);
+}
+
+void IrcServer::enable_metrics(const InetAddress &listen_addr)
+{
+    metrics_exporter_ = std::make_unique<MetricsExporter>(loop_, listen_addr, [this] {
+        auto snapshot = collect_metrics();
+        // on the exporter's own loop
+        snapshot.memory = memory_usage(0, false).subsystems;
+        return metrics::to_prometheus(snapshot, channel_count_.load(std::memory_order_relaxed));
+    });
+}
+
+bool IrcServer::enable_capture(const std::string &path)
+{
+    capture_ = std::make_unique<Capture>(path);
+    if (capture_->is_open()) return true;
+    capture_.reset();
+    return false;
+}
+
+void IrcServer::configure_slowlog(std::int64_t threshold_us, std::size_t capacity, std::string dump_path)
+{
+    slowlog_.set_threshold(threshold_us * 1000);
+    slowlog_.set_capacity(capacity);
+    slowlog_path_ = std::move(dump_path);
+}
+
 void IrcServer::start()
 {
     server_.start();
+    if (metrics_exporter_) metrics_exporter_->start();
+    monitor_.watch(loop_);
+    monitor_.start();
+}
+
+metrics::Snapshot IrcServer::collect_metrics()
+{
+    auto snapshot = metrics::collect();
+    monitor_.fill(snapshot);
+    return snapshot;
+}
+
+IrcServer::MemoryReport IrcServer::memory_usage(std::size_t top, bool with_channels)
+{
+    using memusage::heap;
+    MemoryReport report;
+    auto add = [&report] (const char* name, std::size_t bytes) {
+        report.subsystems.emplace_back(name, static_cast<std::int64_t>(bytes));
+    };
+
+    {
+        PROFILED_LOCK(lock, nick_conn_mutex_);
+
+        std::size_t sessions = clients_.heap_bytes();
+        clients_.for_each([&sessions] (Handle, Client& client) {
+            const auto &session = client.session;
+            sessions += heap(session.nickname) + heap(session.username) + heap(session.realname);
+        });
+        add("clients", sessions);
+
+        std::size_t nicks = heap(nick_conn_);
+        for (const auto &entry : nick_conn_) nicks += heap(entry.first);
+        add("nick_conn", nicks);
+    }
+    if (!with_channels) return report;
+
+    PROFILED_LOCK(channels_lock, channels_mutex_);
+    std::size_t table = heap(channels_), members = 0, modes = 0, topics = 0, names = 0;
+    std::vector<std::pair<std::string, std::int64_t>> largest;
+    for (const auto &[name, info] : channels_)
+    {
+        auto cached = heap(info.names);
+        for (const auto &chunk : info.names) cached += heap(chunk);
+        const auto own = heap(info.users) + heap(info.operators) + heap(info.voices) + heap(info.topic) + cached;
+        table += heap(name);
+        members += heap(info.users);
+        modes += heap(info.operators) + heap(info.voices);
+        topics += heap(info.topic);
+        names += cached;
+        if (top) largest.emplace_back(name, static_cast<std::int64_t>(own + heap(name)));
+    }
+    add("channels", table);
+    add("channel_members", members);
+    add("channel_modes", modes);
+    add("channel_topics", topics);
+    add("channel_names", names);
+
+    std::size_t away = heap(nick_awaymsg_);
+    for (const auto &[nick, message] : nick_awaymsg_) away += heap(nick) + heap(message);
+    add("away_messages", away);
+
+    const auto count = std::min(top, largest.size());
+    std::partial_sort(largest.begin(), largest.begin() + count, largest.end(),
+        [] (const auto& a, const auto& b) { return a.second > b.second; });
+    largest.resize(count);
+    report.channels = std::move(largest);
+    return report;
 }
 
-bool IrcServer::check_registered(const TcpConnectionPtr &conn)
+void IrcServer::send(const Client &client, const std::string &message)
 {
-    return conn_session_.count(conn) &&
-        (conn_session_[conn].state == Session::State::REGISTERED || conn_session_[conn].state == Session::State::AWAY);
+    auto &stats = metrics::local();
+    stats.bytes_out.add(message.size());
+    stats.messages_out.add();
+    const auto traced = trace::current();
+    if (traced) trace::record(traced, trace::kEnqueue, client.self);
+
+    // sends to a connection owned by another loop are batched through its
+    // mailbox instead of each paying a queue_in_loop of their own
+    if (client.mailbox == LoopMailbox::current())
+    {
+        client.conn->send(message);
+        if (traced) trace::record(traced, trace::kWrite, client.self);
+    }
+    else
+    {
+        stats.cross_loop_messages.add();
+        client.mailbox->send(client.conn, message, traced, client.self);
+    }
+}
+
+void IrcServer::send(Handle handle, const std::string &message)
+{
+    if (auto *client = clients_.get(handle))
+        send(*client, message);
+}
+
+bool IrcServer::check_registered(const Client &client)
+{
+    return client.session.state == Session::State::REGISTERED;
 }
 
-bool IrcServer::check_in_channel(const TcpConnectionPtr &conn, const std::string &channel)
+bool IrcServer::check_in_channel(const Client &client, const std::string &channel)
 {
-    if (!channels_.count(channel)) return false;
-    const auto &nicks = channels_[channel].users;
-    return std::find(nicks.begin(), nicks.end(), conn_session_[conn].nickname) != nicks.end();
+    return std::find(client.channels.begin(), client.channels.end(), channel) != client.channels.end();
+}
+
+void IrcServer::leave_channels(Client &client)
+{
+    for (const auto &name : client.channels)
+    {
+        auto it = channels_.find(name);
+        if (it == channels_.end()) continue;
+
+        auto &chinfo = it->second;
+        auto pos = std::find(chinfo.users.begin(), chinfo.users.end(), client.self);
+        if (pos != chinfo.users.end()) chinfo.users.erase(pos);
+        chinfo.operators.erase(client.self);
+        chinfo.voices.erase(client.self);
+        chinfo.names_valid = false;
+        if (chinfo.users.empty())
+        {
+            channels_.erase(it);
+            channel_count_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (directory_) directory_->remove_member(name, client.self);
+    }
+    client.channels.clear();
+}
+
+void IrcServer::publish_user(const Client &client)
+{
+    if (!directory_) return;
+    const auto &session = client.session;
+    if (session.nickname == "*")
+        directory_->remove_user(client.self);
+    else
+        directory_->update_user(client.self, {
+            session.nickname, session.username, session.realname,
+            (client.modes & kUserMode_a) != 0, (client.modes & kUserMode_o) != 0
+        });
+}
+
+void IrcServer::publish_member(const std::string &channel, const ChannelInfo &chinfo, Handle member)
+{
+    if (!directory_) return;
+    directory_->update_member(channel, { member, chinfo.operators.count(member) > 0, chinfo.voices.count(member) > 0 });
+}
+
+std::vector<Handle> IrcServer::neighbours(const Client &client)
+{
+    t_visits.begin();
+    std::vector<Handle> peers;
+    for (const auto &name : client.channels)
+    {
+        auto it = channels_.find(name);
+        if (it == channels_.end()) continue;
+        for (auto member : it->second.users)
+            if (t_visits.first_visit(member)) peers.push_back(member);
+    }
+    return peers;
+}
+
+std::vector<std::string> IrcServer::member_names(const ChannelInfo &chinfo)
+{
+    std::vector<std::string> names;
+    names.reserve(chinfo.users.size());
+    for (auto member : chinfo.users)
+    {
+        const auto *peer = clients_.get(member);
+        if (peer == nullptr) continue;
+
+        if (chinfo.operators.count(member))
+            names.push_back("@" + peer->session.nickname);
+        else if (chinfo.voices.count(member))
+            names.push_back("+" + peer->session.nickname);
+        else
+            names.push_back(peer->session.nickname);
+    }
+    return names;
+}
+
+void IrcServer::append_name(const std::string &channel, ChannelInfo &chinfo, Handle member)
+{
+    const auto *peer = clients_.get(member);
+    if (peer == nullptr) return;
+
+    const char *mark = chinfo.operators.count(member) ? "@" : chinfo.voices.count(member) ? "+" : "";
+    const auto &nick = peer->session.nickname;
+    const auto used = chinfo.names.empty() ? 0 : chinfo.names.back().size();
+    if (chinfo.names.empty() || used + 1 + std::strlen(mark) + nick.size() > reply::namreply_room(kNamesNickRoom, channel))
+        chinfo.names.emplace_back();
+    else
+        chinfo.names.back().push_back(' ');
+    chinfo.names.back().append(mark).append(nick);
+}
+
+std::string IrcServer::names_reply(const std::string &nick, const std::string &channel, ChannelInfo &chinfo)
+{
+    if (nick.size() > kNamesNickRoom)
+        return reply::rpl_namreply(nick, channel, member_names(chinfo));
+
+    if (!chinfo.names_valid)
+    {
+        chinfo.names.clear();
+        for (auto member : chinfo.users) append_name(channel, chinfo, member);
+        chinfo.names_valid = true;
+    }
+    return reply::rpl_namreply_chunks(nick, channel, chinfo.names);
+}
+
+void IrcServer::pin_loop_thread()
+{
+    thread_local bool pinned = false;
+    if (pinned || cpus_.empty()) return;
+    pinned = true;
+
+    // a loop's first connection is the first npcp code it runs, so its
+    // metrics shard, trace ring and mailbox are all first touched after this
+    const auto cpu = cpus_[next_cpu_.fetch_add(1, std::memory_order_relaxed) % cpus_.size()];
+    if (pin_current_thread(cpu))
+        metrics::local().cpu.store(cpu, std::memory_order_relaxed);
+    else
+        std::fprintf(stderr, "cannot pin loop thread to cpu %d\n", cpu);
 }
 
 void IrcServer::on_connection(const TcpConnectionPtr &conn)
 {
-    if (conn->connected() && !conn_session_.count(conn))
+    pin_loop_thread();
+    metrics::CallbackTimer timer;
+    if (conn->connected() && !t_conn_handle.count(conn.get()))
     {
-        conn_session_[conn] = { Session::State::NONE, "*", "", "" };
+        auto *mailbox = monitor_.watch(conn->get_loop());
+        mailbox->make_current();
+
+        Handle handle;
+        {
+            PROFILED_LOCK(lock, nick_conn_mutex_);
+            handle = clients_.emplace();
+            *clients_.get(handle) = { handle, conn, mailbox, { Session::State::NONE, "*", "", "" }, 0, 0, {}, false, {} };
+        }
+        t_conn_handle[conn.get()] = handle;
+        metrics::local().connections.add(1);
+        if (capture_) capture_->record(Capture::kConnect, handle);
     }
-    else if (!conn->connected() && conn_session_.count(conn))
+    else if (!conn->connected() && t_conn_handle.count(conn.get()))
     {
-        std::lock_guard lock(nick_conn_mutex_);
-        if (conn_session_[conn].nickname != "*") 
-            nick_conn_.erase(conn_session_[conn].nickname);
-        conn_session_.erase(conn);
+        auto handle = t_conn_handle[conn.get()];
+        t_conn_handle.erase(conn.get());
+        if (capture_) capture_->record(Capture::kDisconnect, handle);
+        metrics::local().connections.add(-1);
+
+        {
+            // after a QUIT the client is gone already
+            PROFILED_LOCK(lock, nick_conn_mutex_);
+            auto *client = clients_.get(handle);
+            if (client == nullptr) return;
+            if (client->session.nickname != "*")
+                nick_conn_.erase(client->session.nickname);
+            {
+                PROFILED_LOCK(channels_lock, channels_mutex_);
+                leave_channels(*client);
+            }
+            if (directory_) directory_->remove_user(handle);
+            clients_.erase(handle);
+        }
+        reclaim_client(handle);
     }
 }
 
+void IrcServer::reclaim_client(Handle handle)
+{
+    // other loops may still be in a callback that looked the client up
+    // before it was erased; its slot is only reused once they are all out
+    monitor_.quiesce([this, handle] {
+        PROFILED_LOCK(lock, nick_conn_mutex_);
+        clients_.reclaim(handle);
+    });
+}
+
 void IrcServer::on_message(const TcpConnectionPtr &conn, Buffer *buf)
 {
+    metrics::CallbackTimer timer;
+    auto it = t_conn_handle.find(conn.get());
+    const auto handle = it == t_conn_handle.end() ? kNullHandle : it->second;
+
+    // lines of an earlier read are already waiting for their turn, and
+    // these are behind them in buf
+    if (const auto *client = clients_.get(handle); client && client->yielded) return;
+    take_lines(conn, buf, handle);
+}
+
+void IrcServer::take_lines(const TcpConnectionPtr &conn, Buffer *buf, Handle handle)
+{
+    const auto entered = trace::enabled() ? metrics::now_ns() : 0;
+    auto &stats = metrics::local();
+
+    std::size_t taken = 0;
     while (const char* crlf = buf->findCRLF())
     {
-        Message msg(buf->retrieve_as_string(crlf - buf->peek() + 2));
-        auto hs = cal_hash(msg.command().c_str());
+        if (line_budget_ && taken++ == line_budget_ && yield(conn, buf, handle)) return;
 
-        switch (hs)
+        const auto traced = trace::sample();
+        Message msg(buf->retrieve_as_string(crlf - buf->peek() + 2));
+        if (capture_) capture_->record(Capture::kLine, handle, captured_line(msg));
+        stats.bytes_in.add(msg.raw().size());
+        stats.messages_in.add();
+
+        // the client is gone once it QUITs, drop whatever it pipelined after that
+        auto *client = clients_.get(handle);
+        if (client == nullptr) continue;
+
+        // while one of its commands is answered elsewhere, or lines held
+        // behind one are still waiting for their turn, the client's later
+        // lines wait too, to keep its replies in order; a PING doesn't
+        // depend on them and skips the queue, so a client behind a long
+        // listing still gets its PONG in time
+        if ((client->deferred || !client->held.empty()) && !(urgent(msg) && check_registered(*client)))
         {
-            case "NICK"_hash:
-                nick_process(conn, msg);
-                break;
+            client->held.push_back(std::move(msg));
+            continue;
+        }
+        process(client, std::move(msg), traced, entered);
+    }
+}
 
-            case "USER"_hash:
-                user_process(conn, msg);
-                break;
+void IrcServer::process(Client *client, Message msg, std::uint64_t traced, std::int64_t entered)
+{
+    // listings over the whole server go to the query workers; under overload
+    // other expensive ones wait until the loop has caught up with its I/O
+    if (offloadable(*client, msg))
+        offload(*client, msg);
+    else if (shedding(metrics::local()) && expensive(msg))
+        defer(*client, std::move(msg));
+    else
+        dispatch(client, msg, traced, entered);
+}
 
-#define RPL_WHEN_NOTREGISTERED \
-            if (!check_registered(conn)) \
-            { \
-                conn->send(reply::err_notregistered(conn_session_.count(conn) ? conn_session_[conn].nickname : "*")); \
-                break; \
-            }
+void IrcServer::resume(Handle handle)
+{
+    auto *client = clients_.get(handle);
+    if (client == nullptr) return;
 
-            case "QUIT"_hash:
-                quit_process(conn, msg);
-                break;
+    --client->deferred;
+    release_held(handle);
+}
 
-            case "PRIVMSG"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                privmsg_process(conn, msg);
-                break;
+void IrcServer::release_held(Handle handle)
+{
+    auto *client = clients_.get(handle);
+    std::size_t taken = 0;
+    while (client && client->deferred == 0 && !client->held.empty())
+    {
+        // held lines get the same budget as a read, the rest waits for the
+        // loop's next pass
+        if (line_budget_ && taken++ == line_budget_)
+        {
+            metrics::local().yielded_reads.add();
+            client->mailbox->defer([this, handle] { release_held(handle); });
+            return;
+        }
 
-            case "NOTICE"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                notice_process(conn, msg);
-                break;
+        auto msg = std::move(client->held.front());
+        client->held.pop_front();
+        process(client, std::move(msg), 0, 0);
+        // a QUIT has erased the client
+        client = clients_.get(handle);
+    }
+}
 
-            case "PING"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                ping_process(conn, msg);
-                break;
+bool IrcServer::yield(const TcpConnectionPtr &conn, Buffer *buf, Handle handle)
+{
+    auto *client = clients_.get(handle);
+    if (client == nullptr) return false;
+
+    // the rest of buf waits until the loop has served the other connections
+    // that are ready now, then gets another budget
+    client->yielded = true;
+    metrics::local().yielded_reads.add();
+    conn->get_loop()->queue_in_loop([this, conn, buf, handle] {
+        metrics::CallbackTimer timer;
+        auto *client = clients_.get(handle);
+        if (client == nullptr) return;
+        client->yielded = false;
+        take_lines(conn, buf, handle);
+    });
+    return true;
+}
 
-            case ""_hash:
-            case "PONG"_hash:
-                break;
+bool IrcServer::shedding(const metrics::Shard &stats) const
+{
+    return shed_lag_ns_ && stats.recent_lag_ns.value() > shed_lag_ns_;
+}
 
-            case "MOTD"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                motd_process(conn, msg);
-                break;
+bool IrcServer::urgent(const Message &msg)
+{
+    switch (cal_hash(msg.command().c_str()))
+    {
+        case "PING"_hash:
+        case "PONG"_hash:
+            return true;
+        default:
+            return false;
+    }
+}
 
-            case "LUSERS"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                lusers_process(conn, msg);
-                break;
+bool IrcServer::expensive(const Message &msg)
+{
+    const auto &args = msg.args();
+    switch (cal_hash(msg.command().c_str()))
+    {
+        case "NAMES"_hash:
+        case "LIST"_hash:
+            return args.empty();
+        case "WHO"_hash:
+            return args.empty() || args[0] == "*" || args[0] == "0";
+        default:
+            return false;
+    }
+}
 
-            case "WHOIS"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                whois_process(conn, msg);
-                break;
+void IrcServer::defer(Client &client, Message msg)
+{
+    ++client.deferred;
+    metrics::local().shed_commands.add();
+
+    const auto handle = client.self;
+    auto deferred = std::make_shared<Message>(std::move(msg));
+    client.mailbox->defer([this, handle, deferred] {
+        auto *client = clients_.get(handle);
+        if (client == nullptr) return;
+        dispatch(client, *deferred, 0, 0);
+        resume(handle);
+    });
+}
 
-            case "OPER"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                oper_process(conn, msg);
-                break;
+bool IrcServer::offloadable(const Client &client, const Message &msg)
+{
+    if (!directory_ || !check_registered(client)) return false;
 
-            case "MODE"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                mode_process(conn, msg);
-                break;
+    const auto &args = msg.args();
+    switch (cal_hash(msg.command().c_str()))
+    {
+        case "NAMES"_hash:
+        case "LIST"_hash:
+            return args.empty();
+        case "WHO"_hash:
+            return args.empty() || args[0] == "*";
+        default:
+            return false;
+    }
+}
 
-            case "JOIN"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                join_process(conn, msg);
-                break;
+void IrcServer::offload(Client &client, const Message &msg)
+{
+    ++client.deferred;
+    const auto hs = cal_hash(msg.command().c_str());
+    const auto command = to_command(hs);
+    auto &stats = metrics::local();
+    stats.commands[command].add();
+    stats.command_bytes[command].add(msg.raw().size());
+
+    const auto start = metrics::now_ns();
+    directory_->query([this, hs, command, start, handle = client.self, conn = client.conn,
+                       mailbox = client.mailbox, nick = client.session.nickname] (const Tables& tables) {
+        std::string out;
+        std::int64_t bytes = 0, messages = 0;
+        auto emit = [&] (const std::string& line) {
+            bytes += line.size();
+            ++messages;
+            out += line;
+            if (out.size() < kReplyChunk) return;
+            mailbox->send(conn, out);
+            out.clear();
+        };
 
-            case "PART"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                part_process(conn, msg);
-                break;
-            
-            case "TOPIC"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                topic_process(conn, msg);
-                break;
+        switch (hs)
+        {
+            case "LIST"_hash:  list_all(tables, nick, emit); break;
+            case "NAMES"_hash: names_all(tables, nick, emit); break;
+            default:           who_all(tables, nick, handle, emit); break;
+        }
+        if (!out.empty()) mailbox->send(conn, out);
+
+        // queued behind the replies, so the client's next line is handled
+        // after they are written; latency here is the client's wait
+        mailbox->post([this, command, start, handle, bytes, messages] {
+            auto &stats = metrics::local();
+            stats.bytes_out.add(bytes);
+            stats.messages_out.add(messages);
+            stats.command_latency[command].record(metrics::now_ns() - start);
+            resume(handle);
+        });
+    });
+}
 
-            case "AWAY"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                away_process(conn, msg);
-                break;
+void IrcServer::dispatch(Client *client, const Message &msg, std::uint64_t traced, std::int64_t entered)
+{
+    auto &stats = metrics::local();
+    const auto handle = client->self;
 
-            case "NAMES"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                names_process(conn, msg);
-                break;
+    auto hs = cal_hash(msg.command().c_str());
+    const auto command = to_command(hs);
+    const auto bytes_before = stats.bytes_out.value();
+    if (traced)
+    {
+        trace::record(traced, trace::kRead, 0, entered);
+        trace::record(traced, trace::kParsed, command);
+        trace::set_current(traced);
+        trace::record(traced, trace::kHandlerStart);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    allocaccount::Tag tag(command);
 
-            case "LIST"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                list_process(conn, msg);
-                break;
+    switch (hs)
+    {
+        case "NICK"_hash:
+            nick_process(*client, msg);
+            break;
 
-            case "WHO"_hash:
-                RPL_WHEN_NOTREGISTERED;
-                who_process(conn, msg);
-                break;
+        case "USER"_hash:
+            user_process(*client, msg);
+            break;
 
-            default:
-                if (check_registered(conn))
-                    conn->send(reply::err_unknowncommand(
-                        conn_session_.count(conn) ? conn_session_[conn].nickname : "*",
-                        msg.command())
-                    );
-                break;
+#define RPL_WHEN_NOTREGISTERED \
+        if (!check_registered(*client)) \
+        { \
+            send(*client, reply::err_notregistered(client->session.nickname)); \
+            break; \
         }
+
+        case "QUIT"_hash:
+            quit_process(*client, msg);
+            break;
+
+        case "PRIVMSG"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            privmsg_process(*client, msg);
+            break;
+
+        case "NOTICE"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            notice_process(*client, msg);
+            break;
+
+        case "PING"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            ping_process(*client, msg);
+            break;
+
+        case ""_hash:
+        case "PONG"_hash:
+            break;
+
+        case "MOTD"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            motd_process(*client, msg);
+            break;
+
+        case "LUSERS"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            lusers_process(*client, msg);
+            break;
+
+        case "WHOIS"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            whois_process(*client, msg);
+            break;
+
+        case "OPER"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            oper_process(*client, msg);
+            break;
+
+        case "MODE"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            mode_process(*client, msg);
+            break;
+
+        case "JOIN"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            join_process(*client, msg);
+            break;
+
+        case "PART"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            part_process(*client, msg);
+            break;
+
+        case "TOPIC"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            topic_process(*client, msg);
+            break;
+
+        case "AWAY"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            away_process(*client, msg);
+            break;
+
+        case "NAMES"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            names_process(*client, msg);
+            break;
+
+        case "LIST"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            list_process(*client, msg);
+            break;
+
+        case "WHO"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            who_process(*client, msg);
+            break;
+
+        case "STATS"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            stats_process(*client, msg);
+            break;
+
+        case "SLOWLOG"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            slowlog_process(*client, msg);
+            break;
+
+        case "TRACEDUMP"_hash:
+            RPL_WHEN_NOTREGISTERED;
+            tracedump_process(*client, msg);
+            break;
+
+        default:
+            if (check_registered(*client))
+                send(*client, reply::err_unknowncommand(
+                    client->session.nickname,
+                    msg.command())
+                );
+            break;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    if (traced)
+    {
+        trace::record(traced, trace::kHandlerEnd);
+        trace::set_current(0);
+    }
+    stats.commands[command].add();
+    stats.command_bytes[command].add(msg.raw().size());
+    stats.command_latency[command].record(elapsed);
+
+    if (slowlog_.slow(elapsed))
+    {
+        // a QUIT has erased the client by now
+        const auto *after = clients_.get(handle);
+        slowlog_.record(msg, after ? after->session.nickname : "*", stats.id,
+            elapsed, stats.bytes_out.value() - bytes_before);
     }
 }
 
-void IrcServer::nick_process(const TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::nick_process(Client &client, const Message &msg)
 {
-    std::lock_guard lock(nick_conn_mutex_);
+    PROFILED_LOCK(lock, nick_conn_mutex_);
+    auto &session = client.session;
+
     if (msg.args().empty())
-        conn->send(reply::err_nonicknamegiven());
+        send(client, reply::err_nonicknamegiven());
     else if (nick_conn_.count(msg.args().front()))
-        conn->send(reply::err_nicknameinuse(msg.args().front()));
-    else if (conn_session_.count(conn) && conn_session_[conn].state == Session::State::USER)
+        send(client, reply::err_nicknameinuse(msg.args().front()));
+    else if (session.state == Session::State::USER)
     {
-        auto &session = conn_session_[conn];
-        const auto nick = msg.args().front();
+        const auto &nick = msg.args().front();
 
         if (nick_conn_.count(session.nickname))
             nick_conn_.erase(session.nickname);
-        nick_conn_[nick] = conn;
-
-        session = {
-            Session::State::REGISTERED,
-            nick,
-            session.username,
-            session.realname
-        };
+        nick_conn_[nick] = client.self;
 
-        conn->send(reply::rpl_welcome(
-            session.nickname,
-            session.username,
-            "jusot.com") + 
-            reply::rpl_yourhost(nick, "2") + 
-            reply::rpl_created(nick) +
-            reply::rpl_myinfo(nick, "2", "ao", "mtov")
-        );
-        lusers_process(conn, msg);
-        motd_process(conn, msg);
+        session.state = Session::State::REGISTERED;
+        session.nickname = nick;
+        publish_user(client);
+        welcome(client, msg);
     }
-    else if (check_registered(conn))
+    else if (check_registered(client))
     {
-        auto &session = conn_session_[conn];
-        const auto newnick = msg.args().front();
+        const auto &newnick = msg.args().front();
 
-        for (auto &c_chinfo : channels_)
+        auto rpl = reply::rpl_relayed_nick(
+            session.nickname, session.username,
+            newnick
+        );
         {
-            auto &chinfo = c_chinfo.second;
-            if (check_in_channel(conn, c_chinfo.first))
+            PROFILED_LOCK(channels_lock, channels_mutex_);
+            const auto peers = neighbours(client);
+            for (auto peer : peers) send(peer, rpl);
+            metrics::local().fanout.record(peers.size());
+            for (const auto &name : client.channels)
             {
-                for (auto &peer : chinfo.users)
-                {
-                    nick_conn_[peer]->send(reply::rpl_relayed_nick(
-                        session.nickname, session.username,
-                        newnick
-                    ));
-                    if (peer == session.nickname) peer = newnick;
-                }
+                auto it = channels_.find(name);
+                if (it != channels_.end()) it->second.names_valid = false;
             }
         }
 
         nick_conn_.erase(session.nickname);
-        nick_conn_[newnick] = conn;
-        session = {
-            session.state,
-            newnick,
-            session.username,
-            session.realname
-        };
+        nick_conn_[newnick] = client.self;
+        session.nickname = newnick;
+        publish_user(client);
     }
     else
     {
-        const auto nick = msg.args().front();
+        const auto &nick = msg.args().front();
 
-        nick_conn_[nick] = conn;
-        conn_session_[conn] = {Session::State::NICK, nick, "", ""};
+        if (session.nickname != "*")
+            nick_conn_.erase(session.nickname);
+        nick_conn_[nick] = client.self;
+        session = {Session::State::NICK, nick, "", ""};
+        publish_user(client);
     }
 }
 
-void IrcServer::user_process(const TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::user_process(Client &client, const Message &msg)
 {
-    std::lock_guard lock(nick_conn_mutex_);
+    PROFILED_LOCK(lock, nick_conn_mutex_);
+    auto &session = client.session;
 
-    if (check_registered(conn))
-        conn->send(reply::err_alreadyregistered());
+    if (check_registered(client))
+        send(client, reply::err_alreadyregistered());
     else if (msg.args().size() != 4)
-        conn->send(reply::err_needmoreparams(conn_session_.count(conn) ? conn_session_[conn].nickname : "*", msg.command()));
-    else if (conn_session_.count(conn) && conn_session_[conn].state == Session::State::NICK)
+        send(client, reply::err_needmoreparams(session.nickname, msg.command()));
+    else if (session.state == Session::State::NICK)
     {
-        auto& session = conn_session_[conn];
         session = {
             Session::State::REGISTERED,
             session.nickname,
             msg.args()[0],
             msg.args()[3]
         };
-
-        conn->send(reply::rpl_welcome(session.nickname,
-            session.username,
-            "jusot.com" ) + 
-            reply::rpl_yourhost(session.nickname, "2") + 
-            reply::rpl_created(session.nickname) +
-            reply::rpl_myinfo(session.nickname, "2", "ao", "mtov")
-        );
-
-        lusers_process(conn, msg);
-        motd_process(conn, msg);
+        publish_user(client);
+        welcome(client, msg);
     }
     else
     {
-        conn_session_[conn] = { Session::State::USER, "*", msg.args()[0], msg.args()[3] };
+        session = { Session::State::USER, "*", msg.args()[0], msg.args()[3] };
     }
 }
 
-void IrcServer::quit_process(const TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::welcome(Client &client, const Message &msg)
+{
+    const auto &nick = client.session.nickname;
+    auto burst = reply::rpl_welcome(nick, client.session.username, "jusot.com") +
+        reply::rpl_yourhost(nick, "2") +
+        reply::rpl_created(nick) +
+        reply::rpl_myinfo(nick, "2", "ao", "mtov");
+    if (isupport_) burst += reply::rpl_isupport(nick, isupport_tokens());
+    send(client, burst);
+
+    send_lusers(client);
+    motd_process(client, msg);
+}
+
+void IrcServer::quit_process(Client &client, const Message &msg)
 {
-    const auto nick = conn_session_[conn].nickname,
-               user = conn_session_[conn].username;
-    const auto args = msg.args();
-    
+    const auto &nick = client.session.nickname,
+               &user = client.session.username;
+
     std::string quit_message = msg.args().empty() ? "Client Quit" : msg.args().front();
-    
+
     auto rpl = reply::rpl_relayed_quit(nick, user, quit_message);
-    for (auto &c_chinfo : channels_)
+    std::size_t recipients = 0;
     {
-        auto &chinfo = c_chinfo.second;
-        if (check_in_channel(conn, c_chinfo.first))
+        PROFILED_LOCK(channels_lock, channels_mutex_);
+        for (auto peer : neighbours(client))
         {
-            for (auto &peer : chinfo.users)
-            {
-                if (peer == nick) continue;
-                nick_conn_[peer]->send(rpl);
-            }
+            if (peer == client.self) continue;
+            send(peer, rpl);
+            ++recipients;
         }
     }
+    metrics::local().fanout.record(recipients);
+
+    send(client, ":jusot.com ERROR :Closing Link: jusot.com (" + quit_message + ")\r\n");
 
-    conn->send(":jusot.com ERROR :Closing Link: jusot.com (" + quit_message + ")\r\n");
-    
+    auto conn = client.conn;
+    auto *mailbox = client.mailbox;
+    const auto handle = client.self;
     {
-        std::lock_guard lock(nick_conn_mutex_);
-        nick_conn_.erase(conn_session_[conn].nickname);
-        conn_session_.erase(conn);
+        PROFILED_LOCK(lock, nick_conn_mutex_);
+        nick_conn_.erase(nick);
+        {
+            PROFILED_LOCK(channels_lock, channels_mutex_);
+            leave_channels(client);
+        }
+        if (directory_) directory_->remove_user(handle);
+        clients_.erase(handle);
     }
+    reclaim_client(handle);
 
-    conn->get_loop()->queue_in_loop([conn] () {
+    mailbox->post([conn] () {
         conn->shutdown();
     });
 }
 
-void IrcServer::privmsg_process(const TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::privmsg_process(Client &client, const Message &msg)
 {
-    const auto nick = conn_session_[conn].nickname,
-               user = conn_session_[conn].username;
-    const auto args = msg.args();
+    const auto &args = msg.args();
 
     if (args.empty())
-        conn->send(reply::err_norecipient(nick, msg.command()));
+        send(client, reply::err_norecipient(client.session.nickname, msg.command()));
     else if (args.size() == 1)
-        conn->send(reply::err_notexttosend(nick));
-    else if (!nick_conn_.count(args[0]) && !channels_.count(args[0]))
-        conn->send(reply::err_nosuchnick(nick, args[0]));
-    else if (nick_conn_.count(args[0]))
+        send(client, reply::err_notexttosend(client.session.nickname));
+    else
+        relay_text(client, args[0], args[1], true);
+}
+
+void IrcServer::notice_process(Client &client, const Message &msg)
+{
+    const auto &args = msg.args();
+
+    if (args.size() >= 2) relay_text(client, args[0], args[1], false);
+}
+
+void IrcServer::relay_text(Client &client, const std::string &targets, const std::string &text, bool is_privmsg)
+{
+    const auto &nick = client.session.nickname,
+               &user = client.session.username;
+    // a NOTICE is never answered, not even with an error
+    auto fail = [&] (const std::string& rpl) {
+        if (is_privmsg) send(client, rpl);
+    };
+
+    // someone in several of the target channels gets the text once; a nick
+    // named as a target is always sent its own copy
+    PROFILED_LOCK(channels_lock, channels_mutex_);
+    t_visits.begin();
+    std::size_t recipients = 0;
+
+    // over the limit, nothing is sent to anyone; commas alone name no one
+    const auto list = split_targets(targets);
+    if (list.empty())
     {
-        if (conn_session_[nick_conn_[args[0]]].state == Session::State::AWAY)
-        {
-            conn->send(reply::rpl_away(nick, args[0], nick_awaymsg_[args[0]]));
-        }
-        else
-        {
-            nick_conn_[args[0]]->send(reply::rpl_privmsg_or_notice(
-                nick, user, true, args[0], args[1]));
-        }
+        fail(reply::err_norecipient(nick, is_privmsg ? "PRIVMSG" : "NOTICE"));
+        return;
     }
-    else if (check_in_channel(conn, args[0]))
+    if (list.size() > kMaxTextTargets)
     {
-        const auto &chinfo = channels_[args[0]];
-        if (channel_mode_m(chinfo.mode))
+        fail(reply::err_toomanytargets(nick, list[kMaxTextTargets]));
+        return;
+    }
+
+    for (const auto &target : list)
+    {
+        auto peer = nick_conn_.find(target);
+        if (peer != nick_conn_.end())
         {
-            if (chinfo.voices.count(nick))
+            const auto *to = clients_.get(peer->second);
+            if (is_privmsg && to && (to->modes & kUserMode_a))
+                send(client, reply::rpl_away(nick, target, nick_awaymsg_[target]));
+            else
             {
-                const auto &nicks = chinfo.users;
-                auto rpl = reply::rpl_privmsg_or_notice(
-                    nick, user, true, args[0], args[1]);
-                for (const auto &peer : nicks) if (peer != nick)
-                    nick_conn_[peer]->send(rpl);
+                send(peer->second, reply::rpl_privmsg_or_notice(nick, user, is_privmsg, target, text));
+                ++recipients;
             }
-            else conn->send(reply::err_cannotsendtochan(nick, args[0]));
+            continue;
         }
-        else
+
+        auto it = channels_.find(target);
+        if (it == channels_.end())
         {
-            const auto &nicks = chinfo.users;
-            auto rpl = reply::rpl_privmsg_or_notice(
-                nick, user, true, args[0], args[1]);
-            for (const auto &peer : nicks) if (peer != nick)
-                nick_conn_[peer]->send(rpl);
+            fail(reply::err_nosuchnick(nick, target));
+            continue;
+        }
+        const auto &chinfo = it->second;
+        const bool joined = std::find(chinfo.users.begin(), chinfo.users.end(), client.self) != chinfo.users.end();
+        const bool voiced = chinfo.voices.count(client.self) || chinfo.operators.count(client.self);
+        if (!joined || (channel_mode_m(chinfo.mode) && !voiced))
+        {
+            fail(reply::err_cannotsendtochan(nick, target));
+            continue;
         }
-    }
-    else conn->send(reply::err_cannotsendtochan(nick, args[0]));
-}
-
-void IrcServer::notice_process(const TcpConnectionPtr &conn, const Message &msg)
-{
-    const auto nick = conn_session_[conn].nickname,
-               user = conn_session_[conn].username;
-    const auto args = msg.args();
-
-    if (args.size() < 2) return;
 
-    if (nick_conn_.count(args[0]))
-        nick_conn_[args[0]]->send(reply::rpl_privmsg_or_notice(
-            nick, user, false, args[0], args[1]));
-    else if (check_in_channel(conn, args[0]))
-    {
-        const auto &nicks = channels_[args[0]].users;
-        auto rpl = reply::rpl_privmsg_or_notice(
-            nick, user, true, args[0], args[1]);
-        for (const auto &peer : nicks) if (peer != nick)
-            nick_conn_[peer]->send(rpl);
+        const auto rpl = reply::rpl_privmsg_or_notice(nick, user, is_privmsg, target, text);
+        for (auto member : chinfo.users)
+        {
+            if (member == client.self || !t_visits.first_visit(member)) continue;
+            send(member, rpl);
+            ++recipients;
+        }
     }
+    metrics::local().fanout.record(recipients);
 }
 
-void IrcServer::ping_process(const TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::ping_process(Client &client, const Message &msg)
 {
-    conn->send(reply::rpl_pong("jusot.com"));
+    send(client, reply::rpl_pong("jusot.com"));
 }
 
-void IrcServer::motd_process(const TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::motd_process(Client &client, const Message &msg)
 {
-    const auto nick = conn_session_[conn].nickname;
+    const auto &nick = client.session.nickname;
     if (fs::is_regular_file("./motd.txt"))
     {
         std::ifstream fin("./motd.txt");
-        conn->send(reply::rpl_motdstart(nick));
+        send(client, reply::rpl_motdstart(nick));
 
         std::string line;
-        while (fin >> line) conn->send(reply::rpl_motd(nick, line));
-        if (!fin.eof()) conn->send(reply::rpl_motd(nick, ""));
+        while (fin >> line) send(client, reply::rpl_motd(nick, line));
+        if (!fin.eof()) send(client, reply::rpl_motd(nick, ""));
 
-        conn->send(reply::rpl_endofmotd(nick));
+        send(client, reply::rpl_endofmotd(nick));
     }
-    else conn->send(reply::err_nomotd(nick));
+    else send(client, reply::err_nomotd(nick));
+}
+
+void IrcServer::lusers_process(Client &client, const Message &msg)
+{
+    PROFILED_LOCK(lock, nick_conn_mutex_);
+    send_lusers(client);
 }
 
-void IrcServer::lusers_process(const TcpConnectionPtr& conn, const Message& msg)
+void IrcServer::send_lusers(Client &client)
 {
     int users = 0;
     int unknowns = 0;
-    for (const auto& pair: conn_session_)
-    {
-        if (pair.second.state == Session::State::REGISTERED)
+    int opers = 0;
+    clients_.for_each([&] (Handle, const Client &peer) {
+        if (peer.session.state == Session::State::REGISTERED)
             ++users;
         else
             ++unknowns;
-    }
+        if (peer.modes & kUserMode_o)
+            ++opers;
+    });
 
-    const auto nick = conn_session_[conn].nickname;
+    const auto &nick = client.session.nickname;
+    const auto channels = channel_count_.load(std::memory_order_relaxed);
 
-    conn->send(
+    send(client,
         reply::rpl_luserclient(nick, users, 0, 1) +
-        reply::rpl_luserop(nick, operators.size()) + 
+        reply::rpl_luserop(nick, opers) +
         reply::rpl_luserunknown(nick, unknowns) +
-        reply::rpl_luserchannels(nick, channels_.size()) +
+        reply::rpl_luserchannels(nick, channels) +
         reply::rpl_luserme(nick, users + unknowns, 1)
     );
 }
 
-void IrcServer::whois_process(const TcpConnectionPtr& conn, const Message& msg)
+void IrcServer::whois_process(Client &client, const Message &msg)
 {
-    auto args = msg.args();
+    const auto &args = msg.args();
     if (args.size() != 1)
         return;
 
-    const std::string nick = conn_session_[conn].nickname;
-    const std::string peer = args[0];
+    const auto &nick = client.session.nickname;
+    const auto &peer = args[0];
 
-//    const auto& nick = conn_session_[conn].nickname;
-    if (nick_conn_.find(peer) == nick_conn_.end())
+    auto it = nick_conn_.find(peer);
+    const auto *target = it == nick_conn_.end() ? nullptr : clients_.get(it->second);
+    if (target == nullptr)
     {
-        conn->send(reply::err_nosuchnick(conn_session_[conn].nickname, peer));
+        send(client, reply::err_nosuchnick(nick, peer));
     }
     else
     {
-        auto session = conn_session_[nick_conn_[peer]];
-        std::string user = session.username;
-        std::string realname = session.realname;
-        conn->send(reply::rpl_whoisuser(peer, user, realname));
+        const auto &session = target->session;
+        send(client, reply::rpl_whoisuser(peer, session.username, session.realname));
         std::string channels;
-        for (const auto& pair: channels_)
+        PROFILED_LOCK(channels_lock, channels_mutex_);
+        for (const auto &name : target->channels)
         {
-            if (std::find(pair.second.users.begin(), pair.second.users.end(), peer) != pair.second.users.end())
-            {
-                if (pair.second.voices.find(peer) != pair.second.voices.end())
-                    channels.push_back('+');
-                if (pair.second.operators.find(peer) != pair.second.operators.end())
-                    channels.push_back('@');
-                channels.append(pair.first);
-                channels.push_back(' ');
-            }
+            auto joined = channels_.find(name);
+            if (joined == channels_.end()) continue;
+            const auto &chinfo = joined->second;
+            if (chinfo.voices.count(target->self))
+                channels.push_back('+');
+            if (chinfo.operators.count(target->self))
+                channels.push_back('@');
+            channels.append(name);
+            channels.push_back(' ');
         }
         if (!channels.empty())
         {
-            conn->send(reply::rpl_whoischannels(peer, channels));
+            send(client, reply::rpl_whoischannels(peer, channels));
         }
-        conn->send(reply::rpl_whoisserver(peer));
-        if (conn_session_[nick_conn_[peer]].state == Session::State::AWAY)
+        send(client, reply::rpl_whoisserver(peer));
+        if (target->modes & kUserMode_a)
         {
-            conn->send(reply::rpl_away(nick, peer, "I'm away"));
+            send(client, reply::rpl_away(nick, peer, "I'm away"));
         }
-        if (operators.find(peer) != operators.end())
+        if (target->modes & kUserMode_o)
         {
-            conn->send(reply::rpl_whoisoperator(nick, peer));
+            send(client, reply::rpl_whoisoperator(nick, peer));
         }
-        conn->send(reply::rpl_endofwhois(peer));
+        send(client, reply::rpl_endofwhois(peer));
     }
 
 }
 
-void IrcServer::oper_process(const TcpConnectionPtr& conn, const Message& msg)
+void IrcServer::oper_process(Client &client, const Message &msg)
 {
-    auto args = msg.args();
+    const auto &args = msg.args();
     if (args.size() < 2)
-        conn->send(reply::err_needmoreparams(conn_session_[conn].nickname, "OPER"));
-    else if (args[1] != "foobar") // password is foobar
+        send(client, reply::err_needmoreparams(client.session.nickname, "OPER"));
+    else if (args[1] != oper_password_)
     {
-        conn->send(reply::err_passwdmismatch(conn_session_[conn].nickname));
+        send(client, reply::err_passwdmismatch(client.session.nickname));
     }
     else
     {
-        operators.insert(args[0]);
-        conn->send(reply::rpl_youareoper(conn_session_[conn].nickname));
+        {
+            PROFILED_LOCK(lock, nick_conn_mutex_);
+            client.modes |= kUserMode_o;
+        }
+        publish_user(client);
+        send(client, reply::rpl_youareoper(client.session.nickname));
     }
 }
 
-void IrcServer::mode_process(const TcpConnectionPtr& conn, const Message& msg)
+void IrcServer::mode_process(Client &client, const Message &msg)
 {
-    auto args = msg.args();
-    const auto nick = conn_session_[conn].nickname;
+    const auto &args = msg.args();
+    const auto &nick = client.session.nickname;
 
-    if (args.empty())
+    if (args.empty() || (args.size() == 1 && args[0][0] != '#'))
     {
-        conn->send(reply::err_needmoreparams(nick, "MODE"));
+        send(client, reply::err_needmoreparams(nick, "MODE"));
         return;
     }
 
     if (args[0][0] != '#')  // user mode
     {
-        const auto mode = args[1];
-        if (args[0] != nick)
+        const auto &modes = args[1];
+        if (args[0] != nick || (modes[0] != '+' && modes[0] != '-'))
         {
-            conn->send(reply::err_usersdontmatch(nick));
+            send(client, reply::err_usersdontmatch(nick));
+            return;
         }
-        else if (mode[0] != '+' && mode[0] != '-')
+
+        // users can drop o but not give it to themselves, a only follows AWAY
+        std::string relayed;
+        bool adding = true, unknown = false;
+        for (char letter : modes)
         {
-            conn->send(reply::err_usersdontmatch(nick));
+            if (letter == '+' || letter == '-')
+            {
+                adding = letter == '+';
+                continue;
+            }
+            const auto *spec = user_mode(letter);
+            if (spec == nullptr) unknown = true;
+            else if (!adding && (spec->flag & kUserMode_o))
+            {
+                PROFILED_LOCK(lock, nick_conn_mutex_);
+                client.modes &= ~kUserMode_o;
+                relayed += "-o";
+            }
         }
-        else
+        if (unknown) send(client, reply::err_umodeunknownflag(nick));
+        if (!relayed.empty())
         {
-            switch (mode[1])
-            {
-                case 'o':
-                    if (mode[0] == '-')
-                    {
-                        conn->send(":" + nick + " MODE " + nick + " :" + mode + "\r\n");
-                    }
-                    break;
+            send(client, ":" + nick + " MODE " + nick + " :" + relayed + "\r\n");
+            publish_user(client);
+        }
+        return;
+    }
 
-                case 'a':
-                    break;
+    // channel mode
+    const auto &channel = args[0];
+    PROFILED_LOCK(channels_lock, channels_mutex_);
+    auto it = channels_.find(channel);
+    if (it == channels_.end())
+        send(client, reply::err_nosuchchannel(nick, channel));
+    else if (args.size() == 1)
+        send(client, reply::rpl_channelmodeis(nick, channel, channel_mode_to_string(it->second.mode)));
+    else
+        change_channel_modes(client, channel, it->second, args);
+}
 
+void IrcServer::change_channel_modes(Client &client, const std::string &channel, ChannelInfo &chinfo,
+    const std::vector<std::string> &args)
+{
+    const auto &nick = client.session.nickname;
+    const auto &modes = args[1];
 
-                default:
-                    conn->send(reply::err_umodeunknownflag(nick));
-                    break;
-            }
-        }
-    }
-    else  // channel mode
+    struct Change
     {
-        const auto& channel = args[0];
-        if (channels_.find(channel) == channels_.end())
+        bool adding;
+        const ChannelModeSpec* spec;
+        const std::string* target;      // of a member mode
+    };
+    std::vector<Change> changes;
+
+    // chIRC reads a nick after flags that take none ("+t nick") as asking
+    // for a member status that doesn't exist
+    const bool stray_nick = args.size() > 2 && std::none_of(modes.begin(), modes.end(),
+        [] (char letter) { const auto *spec = channel_mode(letter); return spec && spec->flag == 0; });
+
+    bool adding = true;
+    std::size_t next = 2;
+    for (char letter : modes)
+    {
+        if (letter == '+' || letter == '-')
         {
-            conn->send(reply::err_nosuchchannel(nick, channel));
+            adding = letter == '+';
+            continue;
         }
-        else if (args.size() == 1)
+        const auto *spec = channel_mode(letter);
+        if (spec == nullptr || (spec->flag && stray_nick) || (spec->flag == 0 && next == args.size()))
         {
-            conn->send(reply::rpl_channelmodeis(nick, channel, channel_mode_to_string(channels_[channel].mode)));
+            send(client, reply::err_unknownmode(nick, letter, channel));
+            continue;
         }
-        else if (args.size() == 2)
-        {
-            const auto &mode = args[1];
-            if (mode[0] != '+' && mode[0] != '-')
-            {
-                conn->send(reply::err_unknownmode(nick, mode[1], channel));
-            }
-            else
-            {
+        if (spec->flag == 0 && next - 2 == kMaxModeTargets) continue;
+        changes.push_back({ adding, spec, spec->flag ? nullptr : &args[next++] });
+    }
+    if (changes.empty()) return;
 
-#define PROCESS_MODE(M) \
-    if (mode[0] == '+') \
-    { \
-        set_channel_mode(channels_[channel].mode, kChannelMode_##M); \
-        if (channels_[channel].operators.find(nick) != channels_[channel].operators.end()) \
-        { \
-            for (const auto& user: channels_[channel].users) \
-            { \
-                nick_conn_[user]->send(":" + nick + "!" + conn_session_[nick_conn_[user]].username + "@jusot.com MODE " + channel + " " + mode + "\r\n"); \
-            } \
-        } \
-        else \
-        { \
-            conn->send(reply::err_chanoprivsneeded(nick, channel)); \
-        } \
-    } \
-    else if (mode[0] == '-') \
-    { \
-        unset_channel_mode(channels_[channel].mode, kChannelMode_##M); \
-        conn->send(":" + nick + "!" + conn_session_[conn].username + "@jusot.com MODE " + channel + " " + mode + "\r\n"); \
-    }
-
-                switch (mode[1])
-                {
-                    case 'm':
-                        PROCESS_MODE(m);
-                        break;
-
-                    case 't':
-                        PROCESS_MODE(t);
-                        break;
-
-//                    case 'v':
-//                        break;
-
-                    default:
-                        conn->send(reply::err_unknownmode(nick, mode[1], channel));
-                        break;
-                }
-#undef PROCESS_MODE
-            }
+    if (!chinfo.operators.count(client.self) && !(client.modes & kUserMode_o))
+    {
+        send(client, reply::err_chanoprivsneeded(nick, channel));
+        return;
+    }
+
+    // everything that took effect goes out as one MODE line
+    std::string applied, targets;
+    char sign = 0;
+    bool members_changed = false;
+    for (const auto &change : changes)
+    {
+        if (change.spec->flag)
+        {
+            if (change.adding) chinfo.mode |= change.spec->flag;
+            else chinfo.mode &= ~change.spec->flag;
         }
-        else if (args.size() == 3)
+        else
         {
-            const auto& mode = args[1];
-            const auto& nick_mode = args[2];
-            if (mode[0] != '+' && mode[0] != '-')
+            auto target = nick_conn_.find(*change.target);
+            const auto &users = chinfo.users;
+            if (target == nick_conn_.end() || std::find(users.begin(), users.end(), target->second) == users.end())
             {
-                conn->send(reply::err_unknownmode(nick, mode[1], channel));
-            }
-            else
-            {
-                switch (mode[1])
-                {
-                    case 'v':
-                        if (mode[0] == '+')
-                        {
-                            if (channels_[channel].operators.find(nick) != channels_[channel].operators.end())
-                            {
-                                const auto& users = channels_[channel].users;
-                                if (std::find(users.begin(), users.end(), nick_mode) != users.end())
-                                {
-                                    channels_[channel].voices.insert(nick_mode);
-                                    for (const auto& user: channels_[channel].users)
-                                    {
-                                        std::stringstream reply;
-                                        reply << ":" << nick << "!" << conn_session_[nick_conn_[user]].username
-                                              << "@jusot.com MODE " << channel << " " << mode << " " << nick_mode << "\r\n";
-                                        nick_conn_[user]->send(reply.str());
-                                    }
-                                }
-                                else
-                                {
-                                    conn->send(reply::err_usernotinchannel(nick, nick_mode, channel));
-                                }
-                            }
-                            else
-                            {
-                                conn->send(reply::err_chanoprivsneeded(nick, channel));
-                            }
-                        }
-                        else
-                        {
-                            if (channels_[channel].operators.find(nick) != channels_[channel].operators.end())
-                            {
-                                const auto& users = channels_[channel].users;
-                                if (std::find(users.begin(), users.end(), nick_mode) != users.end())
-                                {
-                                    channels_[channel].voices.erase(nick_mode);
-                                    for (const auto& user: channels_[channel].users)
-                                    {
-                                        std::stringstream reply;
-                                        reply << ":" << nick << "!" << conn_session_[nick_conn_[user]].username
-                                              << "@jusot.com MODE " << channel << " " << mode << " " << nick_mode << "\r\n";
-                                        nick_conn_[user]->send(reply.str());
-                                    }
-                                }
-                                else
-                                {
-                                    conn->send(reply::err_usernotinchannel(nick, nick_mode, channel));
-                                }
-                            }
-                            else
-                            {
-                                conn->send(reply::err_chanoprivsneeded(nick, channel));
-                            }
-                        }
-
-                        break;
-
-
-                    case 'o':
-                        if (mode[0] == '+')
-                        {
-                            if (channels_[channel].operators.find(nick) != channels_[channel].operators.end())
-                            {
-                                const auto& users = channels_[channel].users;
-                                if (std::find(users.begin(), users.end(), nick_mode) != users.end())
-                                {
-                                    channels_[channel].operators.insert(nick_mode);
-                                    for (const auto& user: channels_[channel].users)
-                                    {
-                                        std::stringstream reply;
-                                        reply << ":" << nick << "!" << conn_session_[nick_conn_[user]].username
-                                              << "@jusot.com MODE " << channel << " " << mode << " " << nick_mode << "\r\n";
-                                        nick_conn_[user]->send(reply.str());
-                                    }
-                                }
-                                else
-                                {
-                                    conn->send(reply::err_usernotinchannel(nick, nick_mode, channel));
-                                }
-                            }
-                            else
-                            {
-                                conn->send(reply::err_chanoprivsneeded(nick, channel));
-                            }
-                        }
-                        else
-                        {
-                            if (channels_[channel].operators.find(nick) != channels_[channel].operators.end())
-                            {
-                                const auto& users = channels_[channel].users;
-                                if (std::find(users.begin(), users.end(), nick_mode) != users.end())
-                                {
-                                    channels_[channel].operators.erase(nick_mode);
-                                    for (const auto& user: channels_[channel].users)
-                                    {
-                                        std::stringstream reply;
-                                        reply << ":" << nick << "!" << conn_session_[nick_conn_[user]].username
-                                              << "@jusot.com MODE " << channel << " " << mode << " " << nick_mode << "\r\n";
-                                        nick_conn_[user]->send(reply.str());
-                                    }
-                                }
-                                else
-                                {
-                                    conn->send(reply::err_usernotinchannel(nick, nick_mode, channel));
-                                }
-                            }
-                            else
-                            {
-                                conn->send(reply::err_chanoprivsneeded(nick, channel));
-                            }
-                        }
-                        break;
-
-                    default:
-                        conn->send(reply::err_unknownmode(nick, mode[1], channel));
-                        break;
-                }
+                send(client, reply::err_usernotinchannel(nick, *change.target, channel));
+                continue;
             }
+            auto &status = change.spec->letter == 'o' ? chinfo.operators : chinfo.voices;
+            if (change.adding) status.insert(target->second);
+            else status.erase(target->second);
+            publish_member(channel, chinfo, target->second);
+            targets.append(" ").append(*change.target);
+            members_changed = true;
         }
+
+        const char wanted = change.adding ? '+' : '-';
+        if (sign != wanted) applied.push_back(sign = wanted);
+        applied.push_back(change.spec->letter);
     }
+    if (applied.empty()) return;
+
+    if (members_changed) chinfo.names_valid = false;
+
+    const auto rpl = reply::rpl_relayed_mode(nick, client.session.username, channel, applied + targets);
+    for (auto member : chinfo.users) send(member, rpl);
+    metrics::local().fanout.record(chinfo.users.size());
 }
 
-void IrcServer::join_process(const TcpConnectionPtr& conn, const Message& msg)
+void IrcServer::join_process(Client &client, const Message &msg)
 {
-    const auto nick = conn_session_[conn].nickname, 
-               user = conn_session_[conn].username;
-    const auto args = msg.args();
+    const auto &args = msg.args();
 
-    if (args.empty()) conn->send(reply::err_needmoreparams(nick, msg.command()));
-    else if (!channels_.count(args[0]) || !check_in_channel(conn, args[0]))
+    PROFILED_LOCK(channels_lock, channels_mutex_);
+    if (args.empty())
+        send(client, reply::err_needmoreparams(client.session.nickname, msg.command()));
+    else if (args[0] == "0")
     {
-        auto &chinfo = channels_[args[0]];
-        auto &nicks = chinfo.users;
-        if (nicks.empty()) chinfo.operators.insert(nick);
-        nicks.push_back(nick);
-
-        auto replayed_join = reply::rpl_join(nick, user, args[0]);
-        for (const auto &peer : nicks) nick_conn_[peer]->send(replayed_join);
+        // part_channel takes each off the list
+        const auto joined = client.channels;
+        for (const auto &channel : joined)
+            part_channel(client, channel, "");
+    }
+    else if (const auto list = split_targets(args[0]); list.empty())
+        send(client, reply::err_needmoreparams(client.session.nickname, msg.command()));
+    else
+    {
+        // what the joiner gets back goes out in one write however many
+        // channels it asked for
+        std::string own;
+        for (const auto &channel : list)
+            join_channel(client, channel, own);
+        if (!own.empty()) send(client, own);
+    }
+}
 
-        if (!channels_[args[0]].topic.empty())
-            conn->send(reply::rpl_topic(nick, args[0], channels_[args[0]].topic));
+void IrcServer::join_channel(Client &client, const std::string &channel, std::string &own)
+{
+    const auto &nick = client.session.nickname,
+               &user = client.session.username;
 
-        auto users = chinfo.users;
-        for (auto &user : users)
-        {
-            if (chinfo.operators.count(user))
-                user = "@" + user;
-            if (chinfo.voices.count(user))
-                user = "+" + user;
-        }
+    if (check_in_channel(client, channel)) return;
 
-        conn->send(reply::rpl_namreply(
-            nick, args[0], users ));
-        conn->send(reply::rpl_endofnames(nick, args[0]));
+    auto &chinfo = channels_[channel];
+    auto &members = chinfo.users;
+    const bool founder = members.empty();
+    if (founder)
+    {
+        chinfo.operators.insert(client.self);
+        channel_count_.fetch_add(1, std::memory_order_relaxed);
     }
+    members.push_back(client.self);
+    client.channels.push_back(channel);
+    if (chinfo.names_valid) append_name(channel, chinfo, client.self);
+    if (directory_) directory_->add_member(channel, { client.self, founder, false });
+
+    auto replayed_join = reply::rpl_join(nick, user, channel);
+    for (auto peer : members) if (peer != client.self) send(peer, replayed_join);
+    metrics::local().fanout.record(members.size());
+    own += replayed_join;
+
+    if (!chinfo.topic.empty())
+        own += reply::rpl_topic(nick, channel, chinfo.topic);
+
+    own += names_reply(nick, channel, chinfo);
+    own += reply::rpl_endofnames(nick, channel);
 }
 
-void IrcServer::part_process(const TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::part_process(Client &client, const Message &msg)
 {
-    const auto nick = conn_session_[conn].nickname, 
-               user = conn_session_[conn].username;
-    const auto args = msg.args();
+    const auto &args = msg.args();
 
-    if (args.empty()) conn->send(reply::err_needmoreparams(nick, msg.command()));
+    const auto list = args.empty() ? std::vector<std::string>() : split_targets(args[0]);
+    if (list.empty()) send(client, reply::err_needmoreparams(client.session.nickname, msg.command()));
     else
     {
-        const auto channel = args[0],
-                   message = args.size() == 1 ? "" : args[1];
-        if (!channels_.count(channel)) conn->send(reply::err_nosuchchannel(nick, channel));
-        else if (!check_in_channel(conn, channel)) conn->send(reply::err_notonchannel(nick, channel));
-        else
-        {
-            auto rpl = reply::rpl_part(nick, user, channel, message);
+        const auto message = args.size() == 1 ? "" : args[1];
+        PROFILED_LOCK(channels_lock, channels_mutex_);
+        for (const auto &channel : list)
+            part_channel(client, channel, message);
+    }
+}
 
-            auto &users = channels_[channel].users;
-            for (const auto &peer : users) nick_conn_[peer]->send(rpl);
+void IrcServer::part_channel(Client &client, const std::string &channel, const std::string &message)
+{
+    const auto &nick = client.session.nickname,
+               &user = client.session.username;
 
-            auto pos = std::find(users.begin(), users.end(), nick);
-            users.erase(pos);
-            if (users.empty()) channels_.erase(channel);
+    if (!channels_.count(channel)) send(client, reply::err_nosuchchannel(nick, channel));
+    else if (!check_in_channel(client, channel)) send(client, reply::err_notonchannel(nick, channel));
+    else
+    {
+        auto rpl = reply::rpl_part(nick, user, channel, message);
+
+        auto &chinfo = channels_[channel];
+        auto &users = chinfo.users;
+        for (auto peer : users) send(peer, rpl);
+        metrics::local().fanout.record(users.size());
+
+        auto pos = std::find(users.begin(), users.end(), client.self);
+        users.erase(pos);
+        client.channels.erase(std::find(client.channels.begin(), client.channels.end(), channel));
+        chinfo.operators.erase(client.self);
+        chinfo.voices.erase(client.self);
+        chinfo.names_valid = false;
+        if (users.empty())
+        {
+            channels_.erase(channel);
+            channel_count_.fetch_sub(1, std::memory_order_relaxed);
         }
+        if (directory_) directory_->remove_member(channel, client.self);
     }
 }
 
-void IrcServer::topic_process(const TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::topic_process(Client &client, const Message &msg)
 {
-    const auto nick = conn_session_[conn].nickname, 
-               user = conn_session_[conn].username;
-    const auto args = msg.args();
-    
-    if (args.empty()) conn->send(reply::err_needmoreparams(nick, msg.command()));
+    const auto &nick = client.session.nickname,
+               &user = client.session.username;
+    const auto &args = msg.args();
+
+    if (args.empty()) send(client, reply::err_needmoreparams(nick, msg.command()));
     else
     {
         const auto channel = args[0],
                    topic   = args.size() == 1 ? "" : args[1];
-        if (!check_in_channel(conn, channel)) conn->send(reply::err_notonchannel(nick, channel));
+        PROFILED_LOCK(channels_lock, channels_mutex_);
+        if (!check_in_channel(client, channel)) send(client, reply::err_notonchannel(nick, channel));
         else if (args.size() == 2)
         {
             auto &chinfo = channels_[channel];
             chinfo.topic = topic;
+            if (directory_) directory_->set_topic(channel, topic);
             auto rpl = reply::rpl_relayed_topic(nick, user, channel, topic);
 
-            auto &users = channels_[channel].users;
-            for (const auto &peer : users) nick_conn_[peer]->send(rpl);
+            for (auto peer : chinfo.users) send(peer, rpl);
+            metrics::local().fanout.record(chinfo.users.size());
         }
         else if (channels_[args[0]].topic.empty())
         {
-            conn->send(reply::rpl_notopic(nick, args[0]));
+            send(client, reply::rpl_notopic(nick, args[0]));
         }
         else
         {
-            conn->send(reply::rpl_topic(nick, args[0], channels_[args[0]].topic));
+            send(client, reply::rpl_topic(nick, args[0], channels_[args[0]].topic));
         }
     }
 }
 
-void IrcServer::away_process(const TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::away_process(Client &client, const Message &msg)
 {
-    auto &session = conn_session_[conn];
+    auto &session = client.session;
 
     if (!msg.args().empty())
     {
-        session.state = Session::State::AWAY;
+        {
+            PROFILED_LOCK(lock, nick_conn_mutex_);
+            client.modes |= kUserMode_a;
+        }
         nick_awaymsg_[session.nickname] = msg.args()[0];
+        publish_user(client);
 
-        conn->send(reply::rpl_nowaway(session.nickname));
+        send(client, reply::rpl_nowaway(session.nickname));
     }
     else
     {
-        session.state = Session::State::REGISTERED;
+        {
+            PROFILED_LOCK(lock, nick_conn_mutex_);
+            client.modes &= ~kUserMode_a;
+        }
         nick_awaymsg_.erase(session.nickname);
+        publish_user(client);
 
-        conn->send(reply::rpl_unaway(session.nickname));
+        send(client, reply::rpl_unaway(session.nickname));
     }
 }
 
-void IrcServer::names_process(const icarus::TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::names_process(Client &client, const Message &msg)
 {
-    const auto nick = conn_session_[conn].nickname;
+    const auto &nick = client.session.nickname;
+    PROFILED_LOCK(channels_lock, channels_mutex_);
 
     if (msg.args().empty())
     {
         std::set<std::string> allnicks;
         for (const auto & nick_c : nick_conn_) allnicks.insert(nick_c.first);
 
-        for (const auto & c_chinfo : channels_)
+        for (auto & c_chinfo : channels_)
         {
-            const auto & chinfo = c_chinfo.second;
+            auto & chinfo = c_chinfo.second;
             if (!chinfo.users.empty())
-            {
-                auto users = chinfo.users;
-                for (auto &user : users)
-                {
-                    if (chinfo.operators.count(user))
-                        user = "@" + user;
-                    if (chinfo.voices.count(user))
-                        user = "+" + user;
-                }
-                conn->send(reply::rpl_namreply(
-                    nick, c_chinfo.first, users
-                ));
-            }
-            for (const auto & nickname : chinfo.users)
-                if (allnicks.count(nickname)) allnicks.erase(nickname);
+                send(client, names_reply(nick, c_chinfo.first, chinfo));
+            for (auto member : chinfo.users)
+                if (const auto *peer = clients_.get(member))
+                    allnicks.erase(peer->session.nickname);
         }
-        if (!allnicks.empty()) conn->send(reply::rpl_namreply(
+        if (!allnicks.empty()) send(client, reply::rpl_namreply(
             nick, "*", std::vector<std::string>(allnicks.begin(), allnicks.end())
         ));
-        
-        conn->send(reply::rpl_endofnames(nick, "*"));
+
+        send(client, reply::rpl_endofnames(nick, "*"));
     }
     else
     {
-        const auto channel = msg.args()[0];
+        const auto &channel = msg.args()[0];
         if (channels_.count(channel))
         {
-            auto &chinfo = channels_[channel];
-            auto users = channels_[channel].users;
-            for (auto &user : users)
-            {
-                if (chinfo.operators.count(user))
-                    user = "@" + user;
-                if (chinfo.voices.count(user))
-                    user = "+" + user;
-            }
-            conn->send(reply::rpl_namreply(
-                nick, channel, users ));
+            send(client, names_reply(nick, channel, channels_[channel]));
         }
-        conn->send(reply::rpl_endofnames(nick, channel));
+        send(client, reply::rpl_endofnames(nick, channel));
     }
 }
 
-void IrcServer::list_process(const icarus::TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::list_process(Client &client, const Message &msg)
 {
-    const auto nick = conn_session_[conn].nickname;
-    const auto args = msg.args();
+    const auto &nick = client.session.nickname;
+    const auto &args = msg.args();
+    PROFILED_LOCK(channels_lock, channels_mutex_);
     if (args.empty())
     {
         for (const auto &c_chinfo : channels_)
         {
             const auto &chinfo = c_chinfo.second;
-            conn->send(reply::rpl_list(nick, c_chinfo.first, chinfo.users.size(), chinfo.topic));
+            send(client, reply::rpl_list(nick, c_chinfo.first, chinfo.users.size(), chinfo.topic));
         }
     }
     else
     {
+        // a channel that doesn't exist is listed empty, not created
+        static const ChannelInfo none;
         const auto &channel = args[0];
-        const auto &chinfo = channels_[channel];
+        auto it = channels_.find(channel);
+        const auto &chinfo = it == channels_.end() ? none : it->second;
 
-        conn->send(reply::rpl_list(nick, channel, chinfo.users.size(), chinfo.topic));
+        send(client, reply::rpl_list(nick, channel, chinfo.users.size(), chinfo.topic));
     }
-    conn->send(reply::rpl_listend(nick));
+    send(client, reply::rpl_listend(nick));
 }
 
-void IrcServer::who_process(const icarus::TcpConnectionPtr &conn, const Message &msg)
+void IrcServer::who_process(Client &client, const Message &msg)
 {
-    const auto nick = conn_session_[conn].nickname;
-    const auto args = msg.args();
-    
+    const auto &nick = client.session.nickname;
+    const auto &args = msg.args();
+    PROFILED_LOCK(channels_lock, channels_mutex_);
+
     if (args.empty() || args[0] == "*")
     {
         std::set<std::string> nicks;
@@ -1006,28 +1770,31 @@ void IrcServer::who_process(const icarus::TcpConnectionPtr &conn, const Message
 
         for (const auto &c_chinfo : channels_)
         {
-            if (check_in_channel(conn, c_chinfo.first))
+            if (check_in_channel(client, c_chinfo.first))
             {
                 const auto &chinfo = c_chinfo.second;
-                for (const auto &peer : chinfo.users) if (nicks.count(peer))
-                    nicks.erase(peer);
+                for (auto member : chinfo.users)
+                    if (const auto *peer = clients_.get(member))
+                        nicks.erase(peer->session.nickname);
             }
         }
 
         for (const auto &peer : nicks)
         {
             // if (peer == nick) continue;
-            const auto &session = conn_session_[nick_conn_[peer]];
-        
+            const auto *target = clients_.get(nick_conn_[peer]);
+            if (target == nullptr) continue;
+            const auto &session = target->session;
+
             std::string flags;
-            flags += session.state == Session::State::AWAY ? "G" : "H";
-            if (operators.count(session.nickname)) flags += "*";
+            flags += target->modes & kUserMode_a ? "G" : "H";
+            if (target->modes & kUserMode_o) flags += "*";
 
-            conn->send(reply::rpl_whoreply(
+            send(client, reply::rpl_whoreply(
                 nick, "*", session.username, "jusot.com", "jusot.com",
                 peer, flags, session.realname));
         }
-        conn->send(reply::rpl_endofwho(nick, "*"));
+        send(client, reply::rpl_endofwho(nick, "*"));
     }
     else
     {
@@ -1035,24 +1802,233 @@ void IrcServer::who_process(const icarus::TcpConnectionPtr &conn, const Message
         if (channels_.count(channel))
         {
             const auto &chinfo = channels_[channel];
-            for (const auto &peer : chinfo.users)
+            for (auto member : chinfo.users)
             {
                 // if (peer == nick) continue;
-                const auto &session = conn_session_[nick_conn_[peer]];
+                const auto *target = clients_.get(member);
+                if (target == nullptr) continue;
+                const auto &session = target->session;
 
                 std::string flags;
-                flags += session.state == Session::State::AWAY ? "G" : "H";
-                if (operators.count(session.nickname)) flags += "*";
-                if (chinfo.operators.count(session.nickname)) flags += "@";
-                if (chinfo.voices.count(session.nickname)) flags += "+";
+                flags += target->modes & kUserMode_a ? "G" : "H";
+                if (target->modes & kUserMode_o) flags += "*";
+                if (chinfo.operators.count(member)) flags += "@";
+                if (chinfo.voices.count(member)) flags += "+";
 
-                conn->send(reply::rpl_whoreply(
+                send(client, reply::rpl_whoreply(
                     nick, channel, session.username, "jusot.com", "jusot.com",
-                    peer, flags, session.realname));
+                    session.nickname, flags, session.realname));
             }
         }
-        conn->send(reply::rpl_endofwho(nick, channel));
+        send(client, reply::rpl_endofwho(nick, channel));
     }
 }
 
+void IrcServer::stats_process(Client &client, const Message &msg)
+{
+    const auto &nick = client.session.nickname;
+    const auto &args = msg.args();
+
+    if (!(client.modes & kUserMode_o))
+    {
+        send(client, reply::err_noprivileges(nick));
+        return;
+    }
+
+    const std::string letter = args.empty() ? "*" : args[0].substr(0, 1);
+    const auto snapshot = collect_metrics();
+    const auto us = [] (double ns) { return std::to_string(static_cast<long long>(ns / 1000)) + "us"; };
+
+    switch (letter[0])
+    {
+        case 'm':   // commands handled
+            for (std::size_t i = 0; i < metrics::kCommandCount; ++i) if (snapshot.commands[i])
+                send(client, reply::rpl_statscommands(nick, metrics::command_name(i),
+                    snapshot.commands[i], snapshot.command_bytes[i]));
+            break;
+
+        case 'p':   // handling time per command
+            for (std::size_t i = 0; i < metrics::kCommandCount; ++i) if (snapshot.commands[i])
+            {
+                const auto &latency = snapshot.command_latency[i];
+                const auto bound = &metrics::LatencyHistogram::upper_bound;
+                send(client, reply::rpl_statsdebug(nick, letter,
+                    std::string(metrics::command_name(i)) +
+                    " count=" + std::to_string(latency.count) +
+                    " avg=" + us(static_cast<double>(latency.sum) / latency.count) +
+                    " p50<" + us(latency.quantile(0.5, bound)) +
+                    " p99<" + us(latency.quantile(0.99, bound))));
+            }
+            break;
+
+        case 'a':   // heap allocations per command
+            if (!allocaccount::kEnabled)
+            {
+                send(client, reply::rpl_statsdebug(nick, letter,
+                    "allocation accounting is off, build with -DNPCP_ALLOC_ACCOUNTING=ON"));
+                break;
+            }
+            for (std::size_t i = 0; i < metrics::kCommandCount; ++i) if (snapshot.commands[i])
+            {
+                const auto count = static_cast<double>(snapshot.commands[i]);
+                send(client, reply::rpl_statsdebug(nick, letter,
+                    std::string(metrics::command_name(i)) +
+                    " count=" + std::to_string(snapshot.commands[i]) +
+                    " allocs=" + std::to_string(snapshot.command_allocs[i]) +
+                    " bytes=" + std::to_string(snapshot.command_alloc_bytes[i]) +
+                    " allocs/cmd=" + std::to_string(static_cast<long long>(snapshot.command_allocs[i] / count)) +
+                    " bytes/cmd=" + std::to_string(static_cast<long long>(snapshot.command_alloc_bytes[i] / count))));
+            }
+            break;
+
+        case 'l':   // lock contention per call site
+            for (const auto &site : collect_lock_sites()) if (site.acquisitions)
+            {
+                const auto bound = &metrics::LatencyHistogram::upper_bound;
+                send(client, reply::rpl_statsdebug(nick, letter,
+                    site.name +
+                    " acquired=" + std::to_string(site.acquisitions) +
+                    " contended=" + std::to_string(site.contended) +
+                    " wait=" + us(site.wait_ns) +
+                    " hold avg=" + us(static_cast<double>(site.hold_ns) / site.acquisitions) +
+                    " contended wait p50<" + us(site.wait.quantile(0.5, bound)) +
+                    " p99<" + us(site.wait.quantile(0.99, bound))));
+            }
+            break;
+
+        case 'z':   // memory, see memory_usage
+        {
+            const auto report = memory_usage(5, true);
+            for (const auto &[subsystem, bytes] : report.subsystems)
+                send(client, reply::rpl_statsdebug(nick, letter,
+                    subsystem + " " + std::to_string(bytes) + " bytes"));
+            for (const auto &[channel, bytes] : report.channels)
+                send(client, reply::rpl_statsdebug(nick, letter,
+                    "channel " + channel + " " + std::to_string(bytes) + " bytes"));
+
+            // replies queued for another loop; what icarus buffers per
+            // connection isn't visible from here
+            std::vector<std::size_t> loops(snapshot.loops.size());
+            for (std::size_t i = 0; i < loops.size(); ++i) loops[i] = i;
+            std::sort(loops.begin(), loops.end(), [&snapshot] (std::size_t a, std::size_t b) {
+                return snapshot.loops[a].pending_bytes > snapshot.loops[b].pending_bytes;
+            });
+            for (auto i : loops)
+                send(client, reply::rpl_statsdebug(nick, letter,
+                    "loop " + std::to_string(i) + " backlog " +
+                    std::to_string(snapshot.loops[i].pending) + " tasks " +
+                    std::to_string(snapshot.loops[i].pending_bytes) + " bytes"));
+            break;
+        }
+
+        case 't':   // traffic and load
+        {
+            const auto channels = channel_count_.load(std::memory_order_relaxed);
+            send(client, reply::rpl_statsdebug(nick, letter,
+                "in " + std::to_string(snapshot.messages_in) + " messages " +
+                std::to_string(snapshot.bytes_in) + " bytes, out " +
+                std::to_string(snapshot.messages_out) + " messages " +
+                std::to_string(snapshot.bytes_out) + " bytes, " +
+                std::to_string(snapshot.cross_loop_messages) + " of them cross-loop"));
+            for (std::size_t i = 0; i < snapshot.loops.size(); ++i)
+            {
+                const auto &loop = snapshot.loops[i];
+                const auto bound = &metrics::LatencyHistogram::upper_bound;
+                send(client, reply::rpl_statsdebug(nick, letter,
+                    "loop " + std::to_string(i) +
+                    (loop.cpu >= 0 ? " cpu " + std::to_string(loop.cpu) : std::string()) +
+                    " connections " + std::to_string(loop.connections) +
+                    " busy " + std::to_string(loop.utilization / 10) + "%" +
+                    " lag p99<" + us(loop.lag.quantile(0.99, bound)) +
+                    " longest " + us(loop.longest_callback_ns) +
+                    " woke " + us(loop.since_wake_ns) + " ago" +
+                    " pending " + std::to_string(loop.pending) +
+                    " deferred " + std::to_string(loop.deferred) +
+                    " shed " + std::to_string(loop.shed_commands) +
+                    " yielded " + std::to_string(loop.yielded_reads) +
+                    " stall " + us(loop.stall_ns)));
+            }
+            send(client, reply::rpl_statsdebug(nick, letter,
+                "channels " + std::to_string(channels) +
+                " fanout p50<" + std::to_string(static_cast<long long>(
+                    snapshot.fanout.quantile(0.5, &metrics::SizeHistogram::upper_bound))) +
+                " p99<" + std::to_string(static_cast<long long>(
+                    snapshot.fanout.quantile(0.99, &metrics::SizeHistogram::upper_bound)))));
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    send(client, reply::rpl_endofstats(nick, letter));
+}
+
+void IrcServer::slowlog_process(Client &client, const Message &msg)
+{
+    const auto &nick = client.session.nickname;
+    const auto &args = msg.args();
+
+    if (!(client.modes & kUserMode_o))
+    {
+        send(client, reply::err_noprivileges(nick));
+        return;
+    }
+
+    // SLOWLOG [GET [count] | LEN | RESET | DUMP], answered like STATS S
+    const std::string letter = "S";
+    const std::string sub = args.empty() ? "GET" : args[0];
+
+    if (sub == "GET")
+    {
+        const std::size_t count = args.size() > 1 ? std::strtoul(args[1].c_str(), nullptr, 10) : 10;
+        for (const auto &entry : slowlog_.entries(count))
+            send(client, reply::rpl_statsdebug(nick, letter, Slowlog::describe(entry)));
+    }
+    else if (sub == "LEN")
+    {
+        send(client, reply::rpl_statsdebug(nick, letter,
+            std::to_string(slowlog_.size()) + " of " + std::to_string(slowlog_.capacity()) +
+            " entries, threshold " + std::to_string(slowlog_.threshold() / 1000) + "us"));
+    }
+    else if (sub == "RESET")
+    {
+        slowlog_.reset();
+        send(client, reply::rpl_statsdebug(nick, letter, "slowlog cleared"));
+    }
+    else if (sub == "DUMP")
+    {
+        send(client, reply::rpl_statsdebug(nick, letter, slowlog_.dump(slowlog_path_)
+            ? "slowlog written to " + slowlog_path_
+            : "cannot write " + slowlog_path_));
+    }
+    else
+    {
+        send(client, reply::rpl_statsdebug(nick, letter, "usage: SLOWLOG [GET [count] | LEN | RESET | DUMP]"));
+    }
+
+    send(client, reply::rpl_endofstats(nick, letter));
+}
+
+void IrcServer::tracedump_process(Client &client, const Message &msg)
+{
+    const auto &nick = client.session.nickname;
+
+    if (!(client.modes & kUserMode_o))
+    {
+        send(client, reply::err_noprivileges(nick));
+        return;
+    }
+
+    const std::string letter = "T";
+    const auto path = trace::dump_path();
+    if (!trace::enabled())
+        send(client, reply::rpl_statsdebug(nick, letter, "tracing is off, start with --trace-every N"));
+    else
+        send(client, reply::rpl_statsdebug(nick, letter, trace::dump()
+            ? "traces written to " + path
+            : "cannot write " + path));
+    send(client, reply::rpl_endofstats(nick, letter));
+}
+
 } // namespace npcp
\ No newline at end of file
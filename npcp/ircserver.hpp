@@ -4,48 +4,71 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <deque>
+#include <memory>
+#include <atomic>
 #include <unordered_map>
 
-#include "../icarus/icarus/tcpserver.hpp"
-#include "../icarus/icarus/eventloop.hpp"
+#include "capture.hpp"
+#include "message.hpp"
+#include "directory.hpp"
+#include "slowlog.hpp"
+#include "profiledmutex.hpp"
+#include "slottable.hpp"
+#include "loopmonitor.hpp"
+#include "metricsexporter.hpp"
+
+#include "icarus/tcpserver.hpp"
+#include "icarus/eventloop.hpp"
 
 namespace npcp
 {
-class Message;
-
 class IrcServer
 {
   public:
     IrcServer(icarus::EventLoop* loop, const icarus::InetAddress& listen_addr, std::string name);
 
-    void start();
+    // serve Prometheus text on listen_addr, call before start()
+    void enable_metrics(const icarus::InetAddress& listen_addr);
 
-  private:
-    void on_connection(const icarus::TcpConnectionPtr& conn);
-    void on_message(const icarus::TcpConnectionPtr& conn, icarus::Buffer* buf);
+    // record inbound traffic to path for bench/replay, call before start();
+    // false if the file can't be written
+    bool enable_capture(const std::string& path);
+
+    // log commands slower than threshold_us, keeping the newest capacity of
+    // them; SLOWLOG DUMP writes them to dump_path
+    void configure_slowlog(std::int64_t threshold_us, std::size_t capacity, std::string dump_path);
+
+    // I/O threads besides loop's own, 0 serves everything on loop; call
+    // before start()
+    void set_thread_num(int threads);
+
+    // pin each loop thread to the next of cpus, round robin, before it
+    // allocates its per-loop state, so that lands on the CPU's NUMA node
+    void set_cpu_affinity(std::vector<int> cpus);
 
-    bool check_registered(const icarus::TcpConnectionPtr&);
-    bool check_in_channel(const icarus::TcpConnectionPtr&, const std::string&);
-
-    void nick_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void user_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void quit_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void privmsg_process (const icarus::TcpConnectionPtr&, const Message&);
-    void notice_process  (const icarus::TcpConnectionPtr&, const Message&);
-    void ping_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void motd_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void lusers_process  (const icarus::TcpConnectionPtr&, const Message&);
-    void whois_process   (const icarus::TcpConnectionPtr&, const Message&);
-    void oper_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void mode_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void join_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void part_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void topic_process   (const icarus::TcpConnectionPtr&, const Message&);
-    void away_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void names_process   (const icarus::TcpConnectionPtr&, const Message&);
-    void list_process    (const icarus::TcpConnectionPtr&, const Message&);
-    void who_process     (const icarus::TcpConnectionPtr&, const Message&);
+    void set_oper_password(std::string password);
 
+    // while a loop's lag is above lag_ms, expensive listings wait until it
+    // has caught up with its I/O; 0 never defers
+    void set_shed_lag(std::int64_t lag_ms);
+
+    // lines handled per read before the rest of it waits for the loop's
+    // other ready connections; 0 takes every line at once
+    void set_line_budget(std::size_t lines);
+
+    // send 005 ISUPPORT after 004 at registration; off by default, chIRC's
+    // tests expect LUSERS straight after 004
+    void set_isupport(bool advertise);
+
+    // run LIST, NAMES and WHO over the whole server on threads worker
+    // threads against a snapshot of the directory instead of on the loop;
+    // 0 keeps them inline. Call before start()
+    void set_query_threads(std::size_t threads);
+
+    void start();
+
+  private:
     struct Session
     {
         enum class State
@@ -53,32 +76,166 @@ class IrcServer
             NONE,
             NICK,
             USER,
-            REGISTERED,
-            AWAY
+            REGISTERED
         } state;
         std::string nickname;
         std::string username;
         std::string realname;
     };
-    std::unordered_map<std::string, std::string> nick_awaymsg_;
+
+    // connection state, kept inline in clients_ and addressed by its handle
+    struct Client
+    {
+        Handle self;
+        icarus::TcpConnectionPtr conn;
+        LoopMailbox* mailbox;       // of the loop conn lives on
+        Session session;
+        std::uint32_t modes = 0;    // user modes, set under nick_conn_mutex_
+        std::uint32_t deferred = 0; // commands deferred or offloaded, not answered yet
+        std::deque<Message> held;   // lines that came in behind them
+        bool yielded;               // the rest of its input waits for another turn
+        // joined, in the order it joined them; changed on the client's own
+        // loop with channels_mutex_ held, so others read it under that lock
+        std::vector<std::string> channels;
+    };
 
     struct ChannelInfo
     {
-        ChannelInfo() : mode(0) { }
-        std::set<std::string> operators;
-        std::vector<std::string> users;
+        ChannelInfo() : mode(0), names_valid(false) { }
+        std::set<Handle> operators;
+        std::vector<Handle> users;
         uint32_t mode;
-        std::set<std::string> voices;
+        std::set<Handle> voices;
         std::string topic;
+        // NAMES as 353 line bodies, rendered on demand, appended to on JOIN
+        // and dropped when a member leaves, is renamed or changes +o/+v
+        std::vector<std::string> names;
+        bool names_valid;
+    };
+
+    void pin_loop_thread();
+    void on_connection(const icarus::TcpConnectionPtr& conn);
+    void on_message(const icarus::TcpConnectionPtr& conn, icarus::Buffer* buf);
+    // free the slot of a client erased from clients_ once no loop can be
+    // using it; not with nick_conn_mutex_ held
+    void reclaim_client(Handle handle);
+    void take_lines(const icarus::TcpConnectionPtr& conn, icarus::Buffer* buf, Handle handle);
+    // out of line budget: hand the rest of buf back to the loop, false if
+    // the client is gone and its lines are only dropped
+    bool yield(const icarus::TcpConnectionPtr& conn, icarus::Buffer* buf, Handle handle);
+    void process(Client* client, Message msg, std::uint64_t traced, std::int64_t entered);
+    void dispatch(Client* client, const Message& msg, std::uint64_t traced, std::int64_t entered);
+
+    bool shedding(const metrics::Shard& stats) const;
+    static bool expensive(const Message& msg);
+    // keepalives, answered ahead of the client's deferred commands
+    static bool urgent(const Message& msg);
+    void defer(Client& client, Message msg);
+    // the client's deferred or offloaded command is answered, go on with
+    // the lines it held up
+    void resume(Handle handle);
+    // handle the client's held lines, a line budget at a time
+    void release_held(Handle handle);
+
+    bool offloadable(const Client& client, const Message& msg);
+    void offload(Client& client, const Message& msg);
+    // mirror a change into directory_, if there is one; channels only send
+    // what changed, with channels_mutex_ held to keep them in order
+    void publish_user(const Client& client);
+    // member's new chanop and voice
+    void publish_member(const std::string& channel, const ChannelInfo& chinfo, Handle member);
+
+    metrics::Snapshot collect_metrics();
+
+    // approximate heap bytes of server state, and the top largest channels.
+    // Only the tables under nick_conn_mutex_ unless with_channels, which adds
+    // channels_ under channels_mutex_ and the away messages; those change
+    // unguarded on the I/O loops, so only an I/O loop, like every command
+    // that reads them, may ask for it
+    struct MemoryReport
+    {
+        std::vector<std::pair<std::string, std::int64_t>> subsystems;
+        std::vector<std::pair<std::string, std::int64_t>> channels;
     };
+    MemoryReport memory_usage(std::size_t top, bool with_channels);
+
+    void send(const Client&, const std::string&);
+    void send(Handle, const std::string&);
+
+    bool check_registered(const Client&);
+    bool check_in_channel(const Client&, const std::string&);
+
+    // the rest of these take channels_mutex_ as held by their caller
+    void leave_channels(Client&);
+    std::vector<std::string> member_names(const ChannelInfo&);
+    void append_name(const std::string& channel, ChannelInfo&, Handle member);
+    // 353 lines of channel for nick, from the cache where they fit
+    std::string names_reply(const std::string& nick, const std::string& channel, ChannelInfo&);
+    // apply a full mode string such as "+mo-v a b" and relay what took effect
+    void change_channel_modes(Client&, const std::string& channel, ChannelInfo&,
+        const std::vector<std::string>& args);
+    // everyone sharing a channel with client, itself included, once each
+    std::vector<Handle> neighbours(const Client&);
+
+    // 001 to 004, 005 when enabled, LUSERS and MOTD; with nick_conn_mutex_ held
+    void welcome(Client&, const Message&);
+    // 251 to 255, with nick_conn_mutex_ held for the walk over clients_
+    void send_lusers(Client&);
+    // PRIVMSG or NOTICE of text to a comma-separated targets list
+    void relay_text(Client&, const std::string& targets, const std::string& text, bool is_privmsg);
+    // with channels_mutex_ held; replies for client itself are appended to own
+    void join_channel(Client&, const std::string& channel, std::string& own);
+    void part_channel(Client&, const std::string& channel, const std::string& message);
+
+    void nick_process    (Client&, const Message&);
+    void user_process    (Client&, const Message&);
+    void quit_process    (Client&, const Message&);
+    void privmsg_process (Client&, const Message&);
+    void notice_process  (Client&, const Message&);
+    void ping_process    (Client&, const Message&);
+    void motd_process    (Client&, const Message&);
+    void lusers_process  (Client&, const Message&);
+    void whois_process   (Client&, const Message&);
+    void oper_process    (Client&, const Message&);
+    void mode_process    (Client&, const Message&);
+    void join_process    (Client&, const Message&);
+    void part_process    (Client&, const Message&);
+    void topic_process   (Client&, const Message&);
+    void away_process    (Client&, const Message&);
+    void names_process   (Client&, const Message&);
+    void list_process    (Client&, const Message&);
+    void who_process     (Client&, const Message&);
+    void stats_process   (Client&, const Message&);
+    void slowlog_process (Client&, const Message&);
+    void tracedump_process(Client&, const Message&);
+
+    std::unordered_map<std::string, std::string> nick_awaymsg_;
 
-    std::mutex nick_conn_mutex_;
-    std::set<std::string> operators;
-    std::unordered_map<std::string, icarus::TcpConnectionPtr> nick_conn_;
-    std::unordered_map<icarus::TcpConnectionPtr, Session>     conn_session_;
+    // nick_conn_, and clients_ but for get(), see SlotTable
+    ProfiledMutex nick_conn_mutex_;
+    std::string oper_password_;
+    std::int64_t shed_lag_ns_;
+    std::size_t line_budget_;
+    bool isupport_;
+    std::unordered_map<std::string, Handle>                   nick_conn_;
+    SlotTable<Client>                                         clients_;
+    // channels_ and every ChannelInfo in it, taken after nick_conn_mutex_
+    // where both are held
+    ProfiledMutex channels_mutex_;
     std::unordered_map<std::string, ChannelInfo>              channels_;
+    // channels_.size(), kept by the loops for readers without channels_mutex_
+    std::atomic<std::size_t> channel_count_;
 
+    icarus::EventLoop* loop_;
+    std::vector<int> cpus_;
+    std::atomic<std::size_t> next_cpu_;
+    LoopMonitor monitor_;
+    std::unique_ptr<Capture> capture_;      // outlives server_'s I/O threads
+    Slowlog slowlog_;
+    std::string slowlog_path_;
     icarus::TcpServer server_;
+    std::unique_ptr<MetricsExporter> metrics_exporter_;
+    std::unique_ptr<Directory> directory_;  // its workers post to monitor_'s mailboxes
 };
 
 } // namespace npcp
@@ -0,0 +1,113 @@
+#include "loopmailbox.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#include "icarus/tcpconnection.hpp"
+
+namespace
+{
+thread_local npcp::LoopMailbox* t_current = nullptr;
+} // namespace
+
+namespace npcp
+{
+LoopMailbox::LoopMailbox(icarus::EventLoop *loop)
+  : loop_(loop),
+    scheduled_(false),
+    pending_(0),
+    pending_bytes_(0),
+    deferred_count_(0)
+{
+}
+
+LoopMailbox* LoopMailbox::current()
+{
+    return t_current;
+}
+
+void LoopMailbox::make_current()
+{
+    t_current = this;
+}
+
+std::int64_t LoopMailbox::pending() const
+{
+    return pending_.load(std::memory_order_relaxed);
+}
+
+std::int64_t LoopMailbox::pending_bytes() const
+{
+    return pending_bytes_.load(std::memory_order_relaxed);
+}
+
+std::int64_t LoopMailbox::deferred() const
+{
+    return deferred_count_.load(std::memory_order_relaxed);
+}
+
+void LoopMailbox::defer(std::function<void()> cb)
+{
+    deferred_.push_back(std::move(cb));
+    deferred_count_.fetch_add(1, std::memory_order_relaxed);
+    if (deferred_.size() == 1)
+        loop_->queue_in_loop([this] { this->run_deferred(); });
+}
+
+void LoopMailbox::post(std::function<void()> cb)
+{
+    push({ nullptr, std::string(), std::move(cb), 0, 0 });
+}
+
+void LoopMailbox::send(const icarus::TcpConnectionPtr &conn, const std::string &message,
+    std::uint64_t trace, std::uint64_t recipient)
+{
+    push({ conn, message, nullptr, trace, recipient });
+}
+
+void LoopMailbox::push(Task task)
+{
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    pending_bytes_.fetch_add(task.message.size(), std::memory_order_relaxed);
+    queue_.push(std::move(task));
+
+    // the item is linked before the flag is tested, so either we schedule the
+    // drain or the drain that clears the flag after us will see the item
+    if (!scheduled_.exchange(true))
+        loop_->queue_in_loop([this] { this->drain(); });
+}
+
+void LoopMailbox::drain()
+{
+    make_current();
+    metrics::CallbackTimer timer;
+
+    scheduled_.exchange(false);
+    Task task;
+    while (queue_.pop(task))
+    {
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        if (task.cb)
+        {
+            task.cb();
+            continue;
+        }
+        pending_bytes_.fetch_sub(task.message.size(), std::memory_order_relaxed);
+        task.conn->send(task.message);
+        if (task.trace) trace::record(task.trace, trace::kWrite, task.recipient);
+    }
+}
+
+void LoopMailbox::run_deferred()
+{
+    metrics::CallbackTimer timer;
+
+    // queued again rather than looped, so the loop polls between two of them
+    auto cb = std::move(deferred_.front());
+    cb();
+    deferred_.pop_front();
+    deferred_count_.fetch_sub(1, std::memory_order_relaxed);
+    if (!deferred_.empty())
+        loop_->queue_in_loop([this] { this->run_deferred(); });
+}
+
+} // namespace npcp
@@ -0,0 +1,74 @@
+#ifndef NPCP_LOOPMAILBOX_HPP
+#define NPCP_LOOPMAILBOX_HPP
+
+#include <deque>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <functional>
+
+#include "mpscqueue.hpp"
+
+#include "icarus/callbacks.hpp"
+#include "icarus/eventloop.hpp"
+
+namespace npcp
+{
+// Cross-thread work for one EventLoop. Posters push onto a lock-free queue and
+// only the one that finds the mailbox idle queues a drain into the loop, so a
+// burst of sends from a channel fan-out costs the target loop a single
+// queue_in_loop and a single wakeup instead of one per message.
+class LoopMailbox
+{
+  public:
+    explicit LoopMailbox(icarus::EventLoop* loop);
+
+    LoopMailbox(const LoopMailbox&) = delete;
+    LoopMailbox& operator=(const LoopMailbox&) = delete;
+
+    void post(std::function<void()> cb);
+    // trace and recipient only feed the tracer, see trace.hpp
+    void send(const icarus::TcpConnectionPtr& conn, const std::string& message,
+        std::uint64_t trace = 0, std::uint64_t recipient = 0);
+
+    // From the loop's own thread: run cb once the loop has handled the I/O
+    // that is ready now. Deferred callbacks run in order, one per pass of the
+    // loop, so a queue of them never holds up reads for long.
+    void defer(std::function<void()> cb);
+
+    // tasks posted but not run yet, and the bytes of messages among them
+    std::int64_t pending() const;
+    std::int64_t pending_bytes() const;
+    std::int64_t deferred() const;
+
+    // the mailbox of the loop running on the calling thread, or nullptr
+    static LoopMailbox* current();
+    // called from the loop's own thread
+    void make_current();
+
+  private:
+    struct Task
+    {
+        icarus::TcpConnectionPtr conn;
+        std::string message;
+        std::function<void()> cb;
+        std::uint64_t trace;
+        std::uint64_t recipient;
+    };
+
+    void push(Task task);
+    void drain();
+    void run_deferred();
+
+    icarus::EventLoop* loop_;
+    MpscQueue<Task> queue_;
+    std::atomic<bool> scheduled_;
+    std::atomic<std::int64_t> pending_;
+    std::atomic<std::int64_t> pending_bytes_;
+    std::deque<std::function<void()>> deferred_;   // loop thread only
+    std::atomic<std::int64_t> deferred_count_;
+};
+
+} // namespace npcp
+
+#endif // NPCP_LOOPMAILBOX_HPP
@@ -0,0 +1,139 @@
+#include <algorithm>
+
+#include "loopmonitor.hpp"
+#include "trace.hpp"
+
+namespace npcp
+{
+LoopMonitor::LoopMonitor(std::chrono::milliseconds interval)
+  : interval_(interval),
+    running_(false)
+{
+}
+
+LoopMonitor::~LoopMonitor()
+{
+    {
+        std::lock_guard lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+void LoopMonitor::start()
+{
+    std::lock_guard lock(mutex_);
+    if (running_) return;
+    running_ = true;
+    thread_ = std::thread([this] { this->run(); });
+}
+
+LoopMonitor::Entry* LoopMonitor::entry(icarus::EventLoop *loop)
+{
+    std::lock_guard lock(mutex_);
+    for (const auto &e : entries_)
+        if (e->loop == loop) return e.get();
+
+    entries_.push_back(std::make_unique<Entry>(loop));
+    return entries_.back().get();
+}
+
+LoopMailbox* LoopMonitor::watch(icarus::EventLoop *loop)
+{
+    return &entry(loop)->mailbox;
+}
+
+void LoopMonitor::quiesce(std::function<void()> done)
+{
+    std::vector<Entry*> entries;
+    {
+        std::lock_guard lock(mutex_);
+        for (const auto &e : entries_) entries.push_back(e.get());
+    }
+    if (entries.empty())
+    {
+        done();
+        return;
+    }
+
+    // a mailbox task runs between two of its loop's callbacks, so once each
+    // loop has run one posted now, all of them have been between callbacks
+    struct Barrier
+    {
+        std::atomic<std::size_t> left;
+        std::function<void()> done;
+    };
+    auto barrier = std::make_shared<Barrier>();
+    barrier->left.store(entries.size(), std::memory_order_relaxed);
+    barrier->done = std::move(done);
+    for (auto *e : entries)
+        e->mailbox.post([barrier] {
+            if (barrier->left.fetch_sub(1, std::memory_order_acq_rel) == 1) barrier->done();
+        });
+}
+
+void LoopMonitor::probe(Entry *e)
+{
+    // the previous probe hasn't run yet, its age already shows the stall
+    if (e->probe_posted_ns.load(std::memory_order_relaxed)) return;
+
+    const auto posted = metrics::now_ns();
+    e->probe_posted_ns.store(posted, std::memory_order_relaxed);
+    e->mailbox.post([e, posted] {
+        auto &shard = metrics::local();
+        const auto now = metrics::now_ns();
+        shard.loop_lag.record(now - posted);
+        shard.recent_lag_ns.set(now - posted);
+        shard.longest_callback_ns.set(shard.window_longest_ns.value());
+        shard.window_longest_ns.set(0);
+
+        const auto busy = shard.busy_ns.value();
+        // a callback is charged when it ends, so one that straddles two
+        // windows can push a window past 100%
+        if (shard.window_start_ns && now > shard.window_start_ns)
+            shard.utilization.set(std::min<std::int64_t>(
+                (busy - shard.window_busy_ns) * 1000 / (now - shard.window_start_ns), 1000));
+        shard.window_start_ns = now;
+        shard.window_busy_ns = busy;
+        e->shard.store(shard.id, std::memory_order_relaxed);
+        e->probe_posted_ns.store(0, std::memory_order_relaxed);
+    });
+}
+
+void LoopMonitor::run()
+{
+    std::unique_lock lock(mutex_);
+    while (running_)
+    {
+        std::vector<Entry*> entries;
+        for (const auto &e : entries_) entries.push_back(e.get());
+
+        lock.unlock();
+        for (auto *e : entries) probe(e);
+        trace::poll_dump();
+        lock.lock();
+
+        cond_.wait_for(lock, interval_, [this] { return !running_; });
+    }
+}
+
+void LoopMonitor::fill(metrics::Snapshot &snapshot)
+{
+    const auto now = metrics::now_ns();
+    std::lock_guard lock(mutex_);
+    for (const auto &e : entries_)
+    {
+        const auto shard = e->shard.load(std::memory_order_relaxed);
+        if (shard < 0 || static_cast<std::size_t>(shard) >= snapshot.loops.size()) continue;
+
+        auto &loop = snapshot.loops[shard];
+        loop.pending = e->mailbox.pending();
+        loop.pending_bytes = e->mailbox.pending_bytes();
+        loop.deferred = e->mailbox.deferred();
+        if (const auto posted = e->probe_posted_ns.load(std::memory_order_relaxed))
+            loop.stall_ns = now - posted;
+    }
+}
+
+} // namespace npcp
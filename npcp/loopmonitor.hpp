@@ -0,0 +1,73 @@
+#ifndef NPCP_LOOPMONITOR_HPP
+#define NPCP_LOOPMONITOR_HPP
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "metrics.hpp"
+#include "loopmailbox.hpp"
+
+#include "icarus/eventloop.hpp"
+
+namespace npcp
+{
+// Watches the health of I/O loops from the outside. Every interval a probe is
+// queued into each known loop; the delay until it runs is the loop lag, and a
+// probe still waiting is a stall. It also owns each loop's LoopMailbox, whose
+// backlog is the depth of our share of the loop's queue, and services trace
+// dumps requested from a signal handler.
+class LoopMonitor
+{
+  public:
+    explicit LoopMonitor(std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+    ~LoopMonitor();
+
+    LoopMonitor(const LoopMonitor&) = delete;
+    LoopMonitor& operator=(const LoopMonitor&) = delete;
+
+    // start probing loop and return its mailbox, which lives as long as the
+    // monitor; cheap to call again for a loop already watched
+    LoopMailbox* watch(icarus::EventLoop* loop);
+
+    void start();
+
+    // run done, on one of the loops, once every loop watched now has
+    // finished the callback it is in and so holds nothing it looked up
+    // before this call; right away if no loop is watched
+    void quiesce(std::function<void()> done);
+
+    // fill pending/pending_bytes/deferred/stall_ns of the loops in snapshot
+    void fill(metrics::Snapshot& snapshot);
+
+  private:
+    struct Entry
+    {
+        explicit Entry(icarus::EventLoop* loop) : loop(loop), mailbox(loop) { }
+
+        icarus::EventLoop* loop;
+        LoopMailbox mailbox;
+        std::atomic<std::int64_t> probe_posted_ns{0};
+        std::atomic<std::int64_t> shard{-1};
+    };
+
+    Entry* entry(icarus::EventLoop* loop);
+    void probe(Entry* e);
+    void run();
+
+    std::chrono::milliseconds interval_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool running_;
+    std::vector<std::unique_ptr<Entry>> entries_;
+    std::thread thread_;
+};
+
+} // namespace npcp
+
+#endif // NPCP_LOOPMONITOR_HPP
@@ -1,22 +1,164 @@
 #include <unistd.h>
+#include <cctype>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
 #include "ircserver.hpp"
-#include "../icarus/icarus/eventloop.hpp"
+#include "affinity.hpp"
+#include "trace.hpp"
+#include "icarus/eventloop.hpp"
 
 #define _DEBUG
 
+namespace
+{
+struct Options
+{
+    int port = 7776;
+    int threads = 10;
+    std::string cpus;
+    std::string oper_password = "foobar";
+    int metrics_port = 0;
+    std::string capture;
+    long long slowlog_us = 10000;
+    int slowlog_len = 128;
+    std::string slowlog_file = "./slowlog.txt";
+    int trace_every = 0;
+    std::string trace_file = "./trace.json";
+    long long shed_lag_ms = 50;
+    int query_threads = 2;
+    int line_budget = 64;
+    int isupport = 0;
+};
+
+void usage(const char* argv0)
+{
+    std::fprintf(stderr,
+        "usage: %s [-p PORT] [-o OPER_PASSWORD] [--threads N] [--cpus LIST] [--config FILE]\n"
+        "       [--metrics-port PORT] [--capture FILE] [--slowlog-us US] [--slowlog-len N]\n"
+        "       [--slowlog-file FILE] [--trace-every N] [--trace-file FILE] [--shed-lag-ms MS]\n"
+        "       [--query-threads N] [--line-budget N] [--isupport 0|1]\n"
+        "--threads 0 serves every connection on the main loop; --cpus 0-3,8 pins loop\n"
+        "threads round robin; --query-threads 0 answers server-wide LIST, NAMES and WHO\n"
+        "on the loops; --line-budget 0 handles all lines of a read at once; --isupport 1\n"
+        "sends 005 at registration. A config file holds the long options, one per line,\n"
+        "as \"threads 4\" or \"threads = 4\"; the command line overrides it.\n", argv0);
+}
+
+// the lines of a config file as --key value pairs, false if it can't be read
+bool read_config(const char* path, std::vector<std::string>& args)
+{
+    std::ifstream in(path);
+    if (!in) return false;
+
+    for (std::string line; std::getline(in, line); )
+    {
+        line = line.substr(0, line.find('#'));
+        for (auto &c : line) if (c == '=') c = ' ';
+
+        std::istringstream fields(line);
+        std::string key, value;
+        if (!(fields >> key)) continue;
+        std::getline(fields >> std::ws, value);
+        while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back()))) value.pop_back();
+        args.push_back("--" + key);
+        args.push_back(value);
+    }
+    return true;
+}
+
+// false on an unknown option or a missing value
+bool parse(const std::vector<std::string>& args, Options& options)
+{
+    for (std::size_t i = 0; i < args.size(); ++i)
+    {
+        const auto &arg = args[i];
+        // chirc's test harness asks for log levels we don't have
+        if (arg == "-q" || arg == "-v" || arg == "-vv") continue;
+        if (i + 1 == args.size()) return false;
+        const auto &value = args[++i];
+
+        if (arg == "-p" || arg == "--port") options.port = std::atoi(value.c_str());
+        else if (arg == "-o" || arg == "--oper-password") options.oper_password = value;
+        else if (arg == "--threads") options.threads = std::atoi(value.c_str());
+        else if (arg == "--cpus") options.cpus = value;
+        else if (arg == "--config") continue;
+        else if (arg == "--metrics-port") options.metrics_port = std::atoi(value.c_str());
+        else if (arg == "--capture") options.capture = value;
+        else if (arg == "--slowlog-us") options.slowlog_us = std::atoll(value.c_str());
+        else if (arg == "--slowlog-len") options.slowlog_len = std::atoi(value.c_str());
+        else if (arg == "--slowlog-file") options.slowlog_file = value;
+        else if (arg == "--trace-every") options.trace_every = std::atoi(value.c_str());
+        else if (arg == "--trace-file") options.trace_file = value;
+        else if (arg == "--shed-lag-ms") options.shed_lag_ms = std::atoll(value.c_str());
+        else if (arg == "--query-threads") options.query_threads = std::atoi(value.c_str());
+        else if (arg == "--line-budget") options.line_budget = std::atoi(value.c_str());
+        else if (arg == "--isupport") options.isupport = std::atoi(value.c_str());
+        else return false;
+    }
+    return true;
+}
+} // namespace
+
 int main(int argc, char *argv[])
 {
 #ifndef _DEBUG
 //    daemon(0, 0);
 #endif
 
+    std::vector<std::string> args;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--config") == 0 && !read_config(argv[i + 1], args))
+        {
+            std::fprintf(stderr, "cannot read config file %s\n", argv[i + 1]);
+            return 1;
+        }
+    }
+    args.insert(args.end(), argv + 1, argv + argc);
+
+    Options options;
+    if (!parse(args, options) || options.threads < 0 || options.query_threads < 0 || options.line_budget < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    const auto cpus = npcp::parse_cpu_list(options.cpus);
+    if (!options.cpus.empty() && cpus.empty())
+    {
+        std::fprintf(stderr, "bad cpu list %s\n", options.cpus.c_str());
+        return 1;
+    }
+
     icarus::EventLoop loop;
-    icarus::InetAddress addr(7776);
+    icarus::InetAddress addr(options.port);
 
     npcp::IrcServer server(&loop, addr, "irc server");
-    
+    server.set_thread_num(options.threads);
+    server.set_cpu_affinity(cpus);
+    server.set_oper_password(options.oper_password);
+    server.set_shed_lag(options.shed_lag_ms);
+    server.set_query_threads(options.query_threads);
+    server.set_line_budget(options.line_budget);
+    server.set_isupport(options.isupport != 0);
+    if (options.metrics_port)
+        server.enable_metrics(icarus::InetAddress(options.metrics_port));
+    if (!options.capture.empty() && !server.enable_capture(options.capture))
+    {
+        std::fprintf(stderr, "cannot write capture file %s\n", options.capture.c_str());
+        return 1;
+    }
+    server.configure_slowlog(options.slowlog_us, options.slowlog_len, options.slowlog_file);
+    npcp::trace::configure(options.trace_every, options.trace_file);
+    std::signal(SIGUSR1, [] (int) { npcp::trace::request_dump(); });
+
     server.start();
     loop.loop();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,47 @@
+#ifndef NPCP_MEMUSAGE_HPP
+#define NPCP_MEMUSAGE_HPP
+
+#include <set>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <unordered_map>
+
+namespace npcp
+{
+// Rough heap footprint of standard containers, for the memory report. Counts
+// what libstdc++ allocates for the container itself, not what its elements
+// own; callers add that where it matters.
+namespace memusage
+{
+inline std::size_t heap(const std::string& s)
+{
+    // the short string buffer lives inside the object
+    return s.capacity() > 15 ? s.capacity() + 1 : 0;
+}
+
+template <typename T>
+std::size_t heap(const std::vector<T>& v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+// red-black node: colour, three links and the value
+template <typename T>
+std::size_t heap(const std::set<T>& s)
+{
+    return s.size() * (sizeof(T) + 4 * sizeof(void*));
+}
+
+// bucket array plus one node per element: link, value and cached hash
+template <typename K, typename V>
+std::size_t heap(const std::unordered_map<K, V>& m)
+{
+    return m.bucket_count() * sizeof(void*) +
+        m.size() * (sizeof(typename std::unordered_map<K, V>::value_type) + 2 * sizeof(void*));
+}
+
+} // namespace memusage
+} // namespace npcp
+
+#endif // NPCP_MEMUSAGE_HPP
@@ -1,3 +1,4 @@
+#include <utility>
 #include <algorithm>
 
 #include "message.hpp"
@@ -10,17 +11,18 @@ Message::Message(std::string message)
     {
         std::size_t bp= 0;
         while (bp < message.size() && message[bp] == ' ') ++bp;
-        message = message.substr(bp);
+        message.erase(0, bp);
     }
 
-    raw_ = message;
+    // the line is handed over by value, so take it instead of copying it again
+    raw_ = std::move(message);
     if (raw_.empty()) return;
 
     auto crlf_pos = raw_.find("\r\n");
     if (crlf_pos == std::string::npos) return;
     else if (crlf_pos > 510) crlf_pos = 510;
 
-    while (crlf_pos >= 0 && raw_[crlf_pos - 1] == ' ') --crlf_pos;
+    while (crlf_pos > 0 && raw_[crlf_pos - 1] == ' ') --crlf_pos;
 
     std::size_t pos = 0, end_pos;
 
@@ -47,6 +49,8 @@ Message::Message(std::string message)
     while (++end_pos < crlf_pos && raw_[end_pos] == ' ');
     pos = end_pos;
 
+    // most commands carry at most four params (USER), grow once up front
+    if (pos < crlf_pos) args_.reserve(4);
     while (pos < crlf_pos)
     {
         if (raw_[pos] == ':')
@@ -66,37 +70,37 @@ bool Message::with_prefix() const
     return with_prefix_;
 }
 
-std::string Message::nick() const
+const std::string& Message::nick() const
 {
     return nick_;
 }
 
-std::string Message::user() const
+const std::string& Message::user() const
 {
     return user_;
 }
 
-std::string Message::hostname() const
+const std::string& Message::hostname() const
 {
     return hostname_;
 }
 
-std::string Message::raw() const
+const std::string& Message::raw() const
 {
     return raw_;
 }
 
-std::string Message::source() const
+const std::string& Message::source() const
 {
     return source_;
 }
 
-std::string Message::command() const
+const std::string& Message::command() const
 {
     return command_;
 }
 
-std::vector<std::string> Message::args() const
+const std::vector<std::string>& Message::args() const
 {
     return args_;
 }
\ No newline at end of file
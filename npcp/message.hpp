@@ -11,17 +11,21 @@ class Message
 public:
     Message(std::string message);
     ~Message() = default;
+    Message(const Message&) = default;
+    Message(Message&&) = default;
+    Message& operator=(const Message&) = default;
+    Message& operator=(Message&&) = default;
 
     bool with_prefix() const;
 
-    std::string nick() const;
-    std::string user() const;
-    std::string hostname() const;
+    const std::string& nick() const;
+    const std::string& user() const;
+    const std::string& hostname() const;
 
-    std::string raw() const;
-    std::string source() const;
-    std::string command() const;
-    std::vector<std::string> args() const;
+    const std::string& raw() const;
+    const std::string& source() const;
+    const std::string& command() const;
+    const std::vector<std::string>& args() const;
 
 private:
     bool with_prefix_;
@@ -37,4 +41,4 @@ private:
 };
 }
 
-#endif // NPCP_MESSAGE_HPP
\ No newline at end of file
+#endif // NPCP_MESSAGE_HPP
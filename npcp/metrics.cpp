@@ -0,0 +1,235 @@
+#include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+#include "metrics.hpp"
+#include "allocaccount.hpp"
+
+namespace
+{
+const char* const kCommandNames[] = {
+    "NICK", "USER", "QUIT", "PRIVMSG", "NOTICE", "PING", "PONG", "MOTD", "LUSERS",
+    "WHOIS", "OPER", "MODE", "JOIN", "PART", "TOPIC", "AWAY", "NAMES", "LIST", "WHO",
+    "STATS", "SLOWLOG", "TRACEDUMP", "UNKNOWN"
+};
+static_assert(sizeof(kCommandNames) / sizeof(*kCommandNames) == npcp::metrics::kCommandCount);
+
+// shards are never freed, I/O threads live as long as the server
+std::mutex g_shards_mutex;
+std::vector<npcp::metrics::Shard*> g_shards;
+
+npcp::metrics::Shard* register_shard()
+{
+    auto *shard = new npcp::metrics::Shard;
+    shard->registered_ns = npcp::metrics::now_ns();
+    std::lock_guard lock(g_shards_mutex);
+    shard->id = g_shards.size();
+    g_shards.push_back(shard);
+    return shard;
+}
+
+template <typename H>
+void write_histogram(std::ostringstream& out, const std::string& name,
+    const std::string& labels, const npcp::metrics::HistogramData& data, double scale)
+{
+    const auto sep = labels.empty() ? "" : ",";
+    std::int64_t cumulative = 0;
+    for (std::size_t i = 0; i < data.buckets.size(); ++i)
+    {
+        cumulative += data.buckets[i];
+        out << name << "_bucket{" << labels << sep << "le=\"";
+        if (i + 1 == data.buckets.size()) out << "+Inf";
+        else out << H::upper_bound(i) * scale;
+        out << "\"} " << cumulative << '\n';
+    }
+    out << name << "_sum";
+    if (!labels.empty()) out << '{' << labels << '}';
+    out << ' ' << data.sum * scale << '\n';
+    out << name << "_count";
+    if (!labels.empty()) out << '{' << labels << '}';
+    out << ' ' << data.count << '\n';
+}
+} // namespace
+
+namespace npcp
+{
+namespace metrics
+{
+const char* command_name(std::size_t command)
+{
+    return command < kCommandCount ? kCommandNames[command] : "UNKNOWN";
+}
+
+double HistogramData::quantile(double q, double (*upper_bound)(std::size_t)) const
+{
+    if (count == 0) return 0;
+    auto rank = static_cast<std::int64_t>(q * count);
+    std::int64_t seen = 0;
+    for (std::size_t i = 0; i + 1 < buckets.size(); ++i)
+    {
+        seen += buckets[i];
+        if (seen > rank) return upper_bound(i);
+    }
+    return upper_bound(buckets.size() - 1);
+}
+
+Shard& local()
+{
+    thread_local Shard* shard = register_shard();
+    return *shard;
+}
+
+std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CallbackTimer::CallbackTimer()
+  : shard_(local()),
+    start_(now_ns())
+{
+    shard_.last_wake_ns.set(start_);
+}
+
+CallbackTimer::~CallbackTimer()
+{
+    const auto elapsed = now_ns() - start_;
+    shard_.callback_time.record(elapsed);
+    shard_.busy_ns.add(elapsed);
+    if (elapsed > shard_.window_longest_ns.value())
+        shard_.window_longest_ns.set(elapsed);
+}
+
+Snapshot collect()
+{
+    Snapshot snapshot;
+    const auto now = now_ns();
+    std::lock_guard lock(g_shards_mutex);
+    for (const auto *shard : g_shards)
+    {
+        for (std::size_t i = 0; i < kCommandCount; ++i)
+        {
+            snapshot.commands[i] += shard->commands[i].value();
+            snapshot.command_bytes[i] += shard->command_bytes[i].value();
+            snapshot.command_latency[i].merge(shard->command_latency[i]);
+            snapshot.command_allocs[i] += shard->command_allocs[i].value();
+            snapshot.command_alloc_bytes[i] += shard->command_alloc_bytes[i].value();
+        }
+        snapshot.bytes_in += shard->bytes_in.value();
+        snapshot.bytes_out += shard->bytes_out.value();
+        snapshot.messages_in += shard->messages_in.value();
+        snapshot.messages_out += shard->messages_out.value();
+        snapshot.cross_loop_messages += shard->cross_loop_messages.value();
+        snapshot.fanout.merge(shard->fanout);
+
+        LoopSnapshot loop;
+        loop.cpu = shard->cpu.load(std::memory_order_relaxed);
+        loop.connections = shard->connections.value();
+        loop.lag.merge(shard->loop_lag);
+        loop.callbacks.merge(shard->callback_time);
+        loop.busy_ns = shard->busy_ns.value();
+        loop.idle_ns = now - shard->registered_ns - loop.busy_ns;
+        if (shard->last_wake_ns.value())
+            loop.since_wake_ns = now - shard->last_wake_ns.value();
+        loop.utilization = shard->utilization.value();
+        loop.shed_commands = shard->shed_commands.value();
+        loop.yielded_reads = shard->yielded_reads.value();
+        loop.longest_callback_ns = std::max(shard->longest_callback_ns.value(),
+            shard->window_longest_ns.value());
+        snapshot.loops.push_back(loop);
+    }
+    return snapshot;
+}
+
+std::string to_prometheus(const Snapshot& snapshot, std::size_t channels)
+{
+    std::ostringstream out;
+
+    out << "# TYPE npcp_commands_total counter\n";
+    for (std::size_t i = 0; i < kCommandCount; ++i)
+        out << "npcp_commands_total{command=\"" << kCommandNames[i] << "\"} " << snapshot.commands[i] << '\n';
+
+    out << "# TYPE npcp_command_bytes_total counter\n";
+    for (std::size_t i = 0; i < kCommandCount; ++i)
+        out << "npcp_command_bytes_total{command=\"" << kCommandNames[i] << "\"} " << snapshot.command_bytes[i] << '\n';
+
+    out << "# TYPE npcp_command_duration_seconds histogram\n";
+    for (std::size_t i = 0; i < kCommandCount; ++i)
+        write_histogram<LatencyHistogram>(out, "npcp_command_duration_seconds",
+            std::string("command=\"") + kCommandNames[i] + "\"", snapshot.command_latency[i], 1e-9);
+
+    if (allocaccount::kEnabled)
+    {
+        out << "# TYPE npcp_command_allocations_total counter\n";
+        for (std::size_t i = 0; i < kCommandCount; ++i)
+            out << "npcp_command_allocations_total{command=\"" << kCommandNames[i] << "\"} "
+                << snapshot.command_allocs[i] << '\n';
+
+        out << "# TYPE npcp_command_allocated_bytes_total counter\n";
+        for (std::size_t i = 0; i < kCommandCount; ++i)
+            out << "npcp_command_allocated_bytes_total{command=\"" << kCommandNames[i] << "\"} "
+                << snapshot.command_alloc_bytes[i] << '\n';
+    }
+
+    out << "# TYPE npcp_received_bytes_total counter\n"
+        << "npcp_received_bytes_total " << snapshot.bytes_in << '\n'
+        << "# TYPE npcp_sent_bytes_total counter\n"
+        << "npcp_sent_bytes_total " << snapshot.bytes_out << '\n'
+        << "# TYPE npcp_received_messages_total counter\n"
+        << "npcp_received_messages_total " << snapshot.messages_in << '\n'
+        << "# TYPE npcp_sent_messages_total counter\n"
+        << "npcp_sent_messages_total " << snapshot.messages_out << '\n'
+        << "# TYPE npcp_cross_loop_messages_total counter\n"
+        << "npcp_cross_loop_messages_total " << snapshot.cross_loop_messages << '\n';
+
+    out << "# TYPE npcp_connections gauge\n";
+    for (std::size_t i = 0; i < snapshot.loops.size(); ++i)
+        out << "npcp_connections{loop=\"" << i << "\"} " << snapshot.loops[i].connections << '\n';
+
+    out << "# TYPE npcp_loop_lag_seconds histogram\n";
+    for (std::size_t i = 0; i < snapshot.loops.size(); ++i)
+        write_histogram<LatencyHistogram>(out, "npcp_loop_lag_seconds",
+            "loop=\"" + std::to_string(i) + "\"", snapshot.loops[i].lag, 1e-9);
+
+    out << "# TYPE npcp_loop_callback_seconds histogram\n";
+    for (std::size_t i = 0; i < snapshot.loops.size(); ++i)
+        write_histogram<LatencyHistogram>(out, "npcp_loop_callback_seconds",
+            "loop=\"" + std::to_string(i) + "\"", snapshot.loops[i].callbacks, 1e-9);
+
+    const auto loop_gauge = [&] (const char* name, const char* type, auto field, double scale) {
+        out << "# TYPE " << name << ' ' << type << '\n';
+        for (std::size_t i = 0; i < snapshot.loops.size(); ++i)
+            out << name << "{loop=\"" << i << "\"} " << snapshot.loops[i].*field * scale << '\n';
+    };
+    loop_gauge("npcp_loop_busy_seconds_total", "counter", &LoopSnapshot::busy_ns, 1e-9);
+    loop_gauge("npcp_loop_idle_seconds_total", "counter", &LoopSnapshot::idle_ns, 1e-9);
+    loop_gauge("npcp_loop_since_wake_seconds", "gauge", &LoopSnapshot::since_wake_ns, 1e-9);
+    loop_gauge("npcp_loop_longest_callback_seconds", "gauge", &LoopSnapshot::longest_callback_ns, 1e-9);
+    loop_gauge("npcp_loop_utilization_ratio", "gauge", &LoopSnapshot::utilization, 1e-3);
+    loop_gauge("npcp_loop_pending_functors", "gauge", &LoopSnapshot::pending, 1);
+    loop_gauge("npcp_loop_pending_bytes", "gauge", &LoopSnapshot::pending_bytes, 1);
+    loop_gauge("npcp_loop_deferred_commands", "gauge", &LoopSnapshot::deferred, 1);
+    loop_gauge("npcp_loop_shed_commands_total", "counter", &LoopSnapshot::shed_commands, 1);
+    loop_gauge("npcp_loop_yielded_reads_total", "counter", &LoopSnapshot::yielded_reads, 1);
+    loop_gauge("npcp_loop_stall_seconds", "gauge", &LoopSnapshot::stall_ns, 1e-9);
+
+    out << "# TYPE npcp_channels gauge\n"
+        << "npcp_channels " << channels << '\n';
+
+    out << "# TYPE npcp_fanout_recipients histogram\n";
+    write_histogram<SizeHistogram>(out, "npcp_fanout_recipients", "", snapshot.fanout, 1);
+
+    if (!snapshot.memory.empty())
+    {
+        out << "# TYPE npcp_memory_bytes gauge\n";
+        for (const auto &[subsystem, bytes] : snapshot.memory)
+            out << "npcp_memory_bytes{subsystem=\"" << subsystem << "\"} " << bytes << '\n';
+    }
+
+    return out.str();
+}
+
+} // namespace metrics
+} // namespace npcp
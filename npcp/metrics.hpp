@@ -0,0 +1,202 @@
+#ifndef NPCP_METRICS_HPP
+#define NPCP_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+namespace npcp
+{
+namespace metrics
+{
+enum Command : std::size_t
+{
+    kNick, kUser, kQuit, kPrivmsg, kNotice, kPing, kPong, kMotd, kLusers,
+    kWhois, kOper, kMode, kJoin, kPart, kTopic, kAway, kNames, kList, kWho,
+    kStats, kSlowlog, kTracedump, kUnknown,
+    kCommandCount
+};
+
+const char* command_name(std::size_t command);
+
+// Written only by the thread owning the shard, so a plain load/store pair is
+// enough and no locked instruction is paid on the hot path. Readers on other
+// threads see a slightly stale but never torn value.
+class Counter
+{
+  public:
+    void add(std::int64_t n = 1)
+    {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void set(std::int64_t n)
+    {
+        value_.store(n, std::memory_order_relaxed);
+    }
+
+    std::int64_t value() const
+    {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<std::int64_t> value_{0};
+};
+
+// Bucket i counts values below 2^(kShift + i), the last bucket is +Inf.
+template <unsigned kShift>
+class Log2Histogram
+{
+  public:
+    static constexpr std::size_t kBuckets = 24;
+
+    void record(std::uint64_t value)
+    {
+        std::size_t width = value ? 64 - __builtin_clzll(value) : 0;
+        std::size_t index = width > kShift ? width - kShift : 0;
+        buckets_[index < kBuckets ? index : kBuckets].add();
+        sum_.add(static_cast<std::int64_t>(value));
+    }
+
+    static double upper_bound(std::size_t index)
+    {
+        return static_cast<double>(std::uint64_t(1) << (kShift + index));
+    }
+
+    std::int64_t bucket(std::size_t index) const { return buckets_[index].value(); }
+    std::int64_t sum() const { return sum_.value(); }
+
+  private:
+    std::array<Counter, kBuckets + 1> buckets_;
+    Counter sum_;
+};
+
+using LatencyHistogram = Log2Histogram<10>;    // nanoseconds, from ~1us
+using SizeHistogram    = Log2Histogram<0>;
+
+struct HistogramData
+{
+    std::array<std::int64_t, LatencyHistogram::kBuckets + 1> buckets{};
+    std::int64_t sum = 0;
+    std::int64_t count = 0;
+
+    template <typename H>
+    void merge(const H& h)
+    {
+        for (std::size_t i = 0; i < buckets.size(); ++i)
+        {
+            buckets[i] += h.bucket(i);
+            count += h.bucket(i);
+        }
+        sum += h.sum();
+    }
+
+    // value below which the given fraction of samples fall, by bucket bound
+    double quantile(double q, double (*upper_bound)(std::size_t)) const;
+};
+
+// One per I/O thread; every EventLoop runs on its own thread, so a shard is
+// also the per-loop view.
+struct Shard
+{
+    std::array<Counter, kCommandCount> commands;
+    std::array<Counter, kCommandCount> command_bytes;
+    std::array<LatencyHistogram, kCommandCount> command_latency;
+    std::array<Counter, kCommandCount> command_allocs;          // see allocaccount.hpp
+    std::array<Counter, kCommandCount> command_alloc_bytes;
+
+    Counter bytes_in;
+    Counter bytes_out;
+    Counter messages_in;
+    Counter messages_out;
+    Counter cross_loop_messages;    // of messages_out, sent through another loop's mailbox
+    Counter connections;
+    SizeHistogram fanout;
+
+    // loop health, fed by CallbackTimer and LoopMonitor probes
+    std::size_t id = 0;
+    std::atomic<int> cpu{-1};       // the loop thread is pinned to
+    std::int64_t registered_ns = 0;
+    LatencyHistogram loop_lag;
+    LatencyHistogram callback_time;
+    Counter busy_ns;
+    Counter last_wake_ns;
+    Counter longest_callback_ns;    // over the last probe interval
+    Counter window_longest_ns;
+    Counter utilization;            // busy per mille over the last probe interval
+    Counter recent_lag_ns;          // measured by the last probe
+    Counter shed_commands;          // deferred because the loop lagged
+    Counter yielded_reads;          // ran out of line budget, rest left buffered
+    std::int64_t window_start_ns = 0;   // loop thread only
+    std::int64_t window_busy_ns = 0;
+};
+
+// the calling thread's shard, registered on first use
+Shard& local();
+
+std::int64_t now_ns();
+
+// Times one callback run by the current loop.
+class CallbackTimer
+{
+  public:
+    CallbackTimer();
+    ~CallbackTimer();
+
+  private:
+    Shard& shard_;
+    std::int64_t start_;
+};
+
+struct LoopSnapshot
+{
+    int cpu = -1;
+    std::int64_t connections = 0;
+    HistogramData lag;
+    HistogramData callbacks;
+    std::int64_t busy_ns = 0;
+    std::int64_t idle_ns = 0;
+    std::int64_t since_wake_ns = 0;
+    std::int64_t longest_callback_ns = 0;
+    std::int64_t utilization = 0;   // per mille
+    std::int64_t pending = 0;       // functors npcp posted that haven't run yet
+    std::int64_t pending_bytes = 0; // replies among them, not yet handed to icarus
+    std::int64_t deferred = 0;      // commands waiting for the loop to catch up
+    std::int64_t shed_commands = 0;
+    std::int64_t yielded_reads = 0;
+    std::int64_t stall_ns = 0;      // age of an unanswered probe
+};
+
+struct Snapshot
+{
+    std::array<std::int64_t, kCommandCount> commands{};
+    std::array<std::int64_t, kCommandCount> command_bytes{};
+    std::array<HistogramData, kCommandCount> command_latency{};
+    std::array<std::int64_t, kCommandCount> command_allocs{};
+    std::array<std::int64_t, kCommandCount> command_alloc_bytes{};
+
+    std::int64_t bytes_in = 0;
+    std::int64_t bytes_out = 0;
+    std::int64_t messages_in = 0;
+    std::int64_t messages_out = 0;
+    std::int64_t cross_loop_messages = 0;
+    std::vector<LoopSnapshot> loops;    // indexed by shard id
+    HistogramData fanout;
+
+    // approximate heap bytes per subsystem, only filled for the exporter and
+    // then only for the tables under nick_conn_mutex_ (clients, nick_conn)
+    std::vector<std::pair<std::string, std::int64_t>> memory;
+};
+
+Snapshot collect();
+
+std::string to_prometheus(const Snapshot& snapshot, std::size_t channels);
+
+} // namespace metrics
+} // namespace npcp
+
+#endif // NPCP_METRICS_HPP
@@ -0,0 +1,44 @@
+#include "metricsexporter.hpp"
+
+#include "icarus/buffer.hpp"
+#include "icarus/tcpconnection.hpp"
+
+namespace npcp
+{
+using namespace icarus;
+
+MetricsExporter::MetricsExporter(EventLoop *loop, const InetAddress &listen_addr,
+    std::function<std::string()> render)
+  : render_(std::move(render)),
+    server_(loop, listen_addr, "metrics")
+{
+    server_.set_message_callback([this] (const TcpConnectionPtr& conn, Buffer* buf) {
+        this->on_message(conn, buf);
+    });
+}
+
+void MetricsExporter::start()
+{
+    server_.start();
+}
+
+void MetricsExporter::on_message(const TcpConnectionPtr &conn, Buffer *buf)
+{
+    // the request itself doesn't matter, wait for the blank line ending its headers
+    while (const char* crlf = buf->findCRLF())
+    {
+        const bool blank = crlf == buf->peek();
+        buf->retrieve_as_string(crlf - buf->peek() + 2);
+        if (!blank) continue;
+
+        const auto body = render_();
+        conn->send("HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + body);
+        conn->shutdown();
+        break;
+    }
+}
+
+} // namespace npcp
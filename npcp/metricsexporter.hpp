@@ -0,0 +1,31 @@
+#ifndef NPCP_METRICSEXPORTER_HPP
+#define NPCP_METRICSEXPORTER_HPP
+
+#include <string>
+#include <functional>
+
+#include "icarus/tcpserver.hpp"
+#include "icarus/eventloop.hpp"
+
+namespace npcp
+{
+// Answers any HTTP request with the Prometheus text rendered by `render`.
+class MetricsExporter
+{
+  public:
+    MetricsExporter(icarus::EventLoop* loop,
+        const icarus::InetAddress& listen_addr,
+        std::function<std::string()> render);
+
+    void start();
+
+  private:
+    void on_message(const icarus::TcpConnectionPtr& conn, icarus::Buffer* buf);
+
+    std::function<std::string()> render_;
+    icarus::TcpServer server_;
+};
+
+} // namespace npcp
+
+#endif // NPCP_METRICSEXPORTER_HPP
@@ -0,0 +1,124 @@
+#ifndef NPCP_MPSCQUEUE_HPP
+#define NPCP_MPSCQUEUE_HPP
+
+#include <atomic>
+#include <vector>
+#include <utility>
+
+namespace npcp
+{
+// Unbounded lock-free multi-producer single-consumer queue (Vyukov).
+// push() is one exchange plus one store and never blocks; pop() is only
+// called by the owning thread. Nodes are recycled, so a steady stream of
+// posts doesn't touch the allocator: the consumer hands the nodes it retires
+// back on a free list, and a producer whose per-thread cache runs dry takes
+// the whole list at once, which a single exchange does without ABA.
+template <typename T>
+class MpscQueue
+{
+  public:
+    MpscQueue()
+      : head_(new Node),
+        tail_(head_.load(std::memory_order_relaxed)),
+        free_(nullptr)
+    {
+    }
+
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value)) { }
+        delete tail_;
+        for (auto *node = free_.load(std::memory_order_acquire); node != nullptr; )
+        {
+            auto *next = node->next.load(std::memory_order_relaxed);
+            delete node;
+            node = next;
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value)
+    {
+        auto *node = acquire();
+        node->value = std::move(value);
+        node->next.store(nullptr, std::memory_order_relaxed);
+        auto *prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // May report empty while a producer sits between its exchange and its
+    // link store; that producer's own post-push signal covers the item.
+    bool pop(T& value)
+    {
+        auto *tail = tail_;
+        auto *next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) return false;
+
+        value = std::move(next->value);
+        next->value = T();
+        tail_ = next;
+        release(tail);
+        return true;
+    }
+
+  private:
+    struct Node
+    {
+        std::atomic<Node*> next{nullptr};
+        T value;
+    };
+
+    static constexpr std::size_t kCacheSize = 1024;
+
+    struct Cache
+    {
+        ~Cache() { for (auto *node : nodes) delete node; }
+        std::vector<Node*> nodes;
+    };
+
+    static Cache& cache()
+    {
+        thread_local Cache cache;
+        return cache;
+    }
+
+    Node* acquire()
+    {
+        auto &nodes = cache().nodes;
+        if (nodes.empty())
+        {
+            // what the cache can't hold goes back to the allocator
+            for (auto *node = free_.exchange(nullptr, std::memory_order_acquire); node != nullptr; )
+            {
+                auto *next = node->next.load(std::memory_order_relaxed);
+                if (nodes.size() < kCacheSize) nodes.push_back(node);
+                else delete node;
+                node = next;
+            }
+            if (nodes.empty()) return new Node;
+        }
+        auto *node = nodes.back();
+        nodes.pop_back();
+        return node;
+    }
+
+    // only the consumer pushes here and producers only take the whole list
+    void release(Node* node)
+    {
+        auto *top = free_.load(std::memory_order_relaxed);
+        do
+            node->next.store(top, std::memory_order_relaxed);
+        while (!free_.compare_exchange_weak(top, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    alignas(64) std::atomic<Node*> head_;
+    alignas(64) Node* tail_;
+    alignas(64) std::atomic<Node*> free_;     // retired nodes, linked by next
+};
+
+} // namespace npcp
+
+#endif // NPCP_MPSCQUEUE_HPP
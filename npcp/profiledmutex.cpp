@@ -0,0 +1,63 @@
+#include "profiledmutex.hpp"
+
+namespace
+{
+// sites are function-local statics, they live as long as the program
+std::mutex g_sites_mutex;
+std::vector<npcp::LockSite*> g_sites;
+} // namespace
+
+namespace npcp
+{
+LockSite::LockSite(const char* mutex, const char* function, int line)
+  : name(std::string(mutex) + " " + function + ":" + std::to_string(line))
+{
+    std::lock_guard lock(g_sites_mutex);
+    g_sites.push_back(this);
+}
+
+void ProfiledMutex::lock(LockSite &site)
+{
+    if (mutex_.try_lock())
+    {
+        acquired_ns_ = metrics::now_ns();
+    }
+    else
+    {
+        const auto start = metrics::now_ns();
+        mutex_.lock();
+        acquired_ns_ = metrics::now_ns();
+
+        const auto waited = acquired_ns_ - start;
+        site.contended.add();
+        site.wait_ns.add(waited);
+        site.wait.record(waited);
+    }
+    site.acquisitions.add();
+}
+
+void ProfiledMutex::unlock(LockSite &site)
+{
+    site.hold_ns.add(metrics::now_ns() - acquired_ns_);
+    mutex_.unlock();
+}
+
+std::vector<LockSiteSnapshot> collect_lock_sites()
+{
+    std::vector<LockSiteSnapshot> snapshot;
+    std::lock_guard lock(g_sites_mutex);
+    for (const auto *site : g_sites)
+    {
+        LockSiteSnapshot s;
+        s.name = site->name;
+        s.acquisitions = site->acquisitions.value();
+        s.contended = site->contended.value();
+        s.wait_ns = site->wait_ns.value();
+        s.hold_ns = site->hold_ns.value();
+        s.wait.merge(site->wait);
+        snapshot.push_back(std::move(s));
+    }
+    return snapshot;
+}
+
+} // namespace npcp
@@ -0,0 +1,84 @@
+#ifndef NPCP_PROFILEDMUTEX_HPP
+#define NPCP_PROFILEDMUTEX_HPP
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "metrics.hpp"
+
+namespace npcp
+{
+// Contention figures for one place that takes a ProfiledMutex. They are only
+// written while that mutex is held, so the single-writer metrics::Counter is
+// enough even though every thread passes through.
+struct LockSite
+{
+    LockSite(const char* mutex, const char* function, int line);
+
+    std::string name;               // mutex function:line
+    metrics::Counter acquisitions;
+    metrics::Counter contended;
+    metrics::Counter wait_ns;
+    metrics::Counter hold_ns;
+    metrics::LatencyHistogram wait; // contended acquisitions only
+};
+
+// std::mutex that charges wait and hold time to the LockSite taking it. The
+// uncontended path adds a try_lock and two clock reads.
+class ProfiledMutex
+{
+  public:
+    void lock(LockSite& site);
+    void unlock(LockSite& site);
+
+  private:
+    std::mutex mutex_;
+    std::int64_t acquired_ns_ = 0;  // guarded by mutex_
+};
+
+class ProfiledLock
+{
+  public:
+    ProfiledLock(ProfiledMutex& mutex, LockSite& site)
+      : mutex_(mutex),
+        site_(site)
+    {
+        mutex_.lock(site_);
+    }
+
+    ~ProfiledLock()
+    {
+        mutex_.unlock(site_);
+    }
+
+    ProfiledLock(const ProfiledLock&) = delete;
+    ProfiledLock& operator=(const ProfiledLock&) = delete;
+
+  private:
+    ProfiledMutex& mutex_;
+    LockSite& site_;
+};
+
+struct LockSiteSnapshot
+{
+    std::string name;
+    std::int64_t acquisitions = 0;
+    std::int64_t contended = 0;
+    std::int64_t wait_ns = 0;
+    std::int64_t hold_ns = 0;
+    metrics::HistogramData wait;
+};
+
+// every site that has been reached so far
+std::vector<LockSiteSnapshot> collect_lock_sites();
+
+} // namespace npcp
+
+// locks mutex for the rest of the scope, as a call site of its own
+#define PROFILED_LOCK(lock, mutex) \
+    static npcp::LockSite lock##_site(#mutex, __func__, __LINE__); \
+    npcp::ProfiledLock lock(mutex, lock##_site)
+
+#endif // NPCP_PROFILEDMUTEX_HPP
@@ -3,6 +3,9 @@
 #include <cassert>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <string_view>
+#include <initializer_list>
 
 #include "rplfuncs.hpp"
 
@@ -11,12 +14,31 @@ namespace
 const std::string _m_hostname(":jusot.com");
 const std::string _hostname("jusot.com");
 
-std::string gen_reply(const std::vector<std::string> &args)
+// joins args with spaces into one buffer sized up front, truncated to 510 bytes
+std::string gen_reply(std::initializer_list<std::string_view> args)
 {
+    std::size_t len = 0;
+    for (const auto& arg : args) len += arg.size() + 1;
+
     std::string reply;
-    for (const auto& arg : args) reply.append(arg + ' ');
-    reply.pop_back();
-    return ((reply.size() > 510) ? reply.substr(0, 510) : reply) + "\r\n";
+    reply.reserve(std::min<std::size_t>(len - 1, 510) + 2);
+    for (const auto& arg : args)
+    {
+        if (&arg != args.begin()) reply.push_back(' ');
+        reply.append(arg.data(), arg.size());
+        if (reply.size() >= 510) break;
+    }
+    if (reply.size() > 510) reply.resize(510);
+    reply.append("\r\n");
+    return reply;
+}
+
+std::string user_prefix(const std::string& nick, const std::string& user)
+{
+    std::string prefix;
+    prefix.reserve(nick.size() + user.size() + 12);
+    prefix.append(":").append(nick).append("!").append(user).append("@jusot.com");
+    return prefix;
 }
 } // namespace
 
@@ -40,7 +62,7 @@ std::string rpl_privmsg_or_notice(const std::string& nick,
     const std::string& msg)
 {
     return gen_reply({
-        ":" + nick + "!" + user + "@jusot.com",
+        user_prefix(nick, user),
         is_privmsg ? "PRIVMSG" : "NOTICE",
         target,
         ":" + msg
@@ -52,7 +74,7 @@ std::string rpl_join(const std::string& nick,
     const std::string& channel)
 {
     return gen_reply({
-        ":" + nick + "!" + user + "@jusot.com",
+        user_prefix(nick, user),
         "JOIN",
         channel
     });
@@ -64,12 +86,12 @@ std::string rpl_part(const std::string& nick,
     const std::string& message)
 {
     if (message.empty()) return gen_reply({
-        ":" + nick + "!" + user + "@jusot.com",
+        user_prefix(nick, user),
         "PART",
         channel
     });
     else return gen_reply({
-        ":" + nick + "!" + user + "@jusot.com",
+        user_prefix(nick, user),
         "PART",
         channel,
         ":" + message
@@ -82,7 +104,7 @@ std::string rpl_relayed_topic(const std::string& nick,
     const std::string& topic)
 {
     return gen_reply({
-        ":" + nick + "!" + user + "@jusot.com",
+        user_prefix(nick, user),
         "TOPIC",
         channel,
         ":" + topic
@@ -94,7 +116,7 @@ std::string rpl_relayed_nick(const std::string& nick,
     const std::string& newnick)
 {
     return gen_reply({
-        ":" + nick + "!" + user + "@jusot.com",
+        user_prefix(nick, user),
         "NICK",
         ":" + newnick
     });
@@ -105,12 +127,25 @@ std::string rpl_relayed_quit(const std::string& nick,
     const std::string& message)
 {
     return gen_reply({
-        ":" + nick + "!" + user + "@jusot.com",
+        user_prefix(nick, user),
         "QUIT",
         ":" + message
     });
 }
 
+std::string rpl_relayed_mode(const std::string& nick,
+    const std::string& user,
+    const std::string& target,
+    const std::string& changes)
+{
+    return gen_reply({
+        user_prefix(nick, user),
+        "MODE",
+        target,
+        changes
+    });
+}
+
 
 std::string rpl_welcome(const std::string& nick,
     const std::string &user,
@@ -163,6 +198,59 @@ std::string rpl_myinfo(const std::string & nick,
         });
 }
 
+std::string rpl_isupport(const std::string& nick,
+    const std::string& tokens)
+{
+    return gen_reply({
+        _m_hostname,
+        "005",
+        nick,
+        tokens,
+        ":are supported by this server"
+        });
+}
+
+std::string rpl_statscommands(const std::string& nick,
+    const std::string& command,
+    long long count,
+    long long bytes)
+{
+    return gen_reply({
+        _m_hostname,
+        "212",
+        nick,
+        command,
+        std::to_string(count),
+        std::to_string(bytes),
+        "0"
+    });
+}
+
+std::string rpl_endofstats(const std::string& nick,
+    const std::string& letter)
+{
+    return gen_reply({
+        _m_hostname,
+        "219",
+        nick,
+        letter,
+        ":End of STATS report"
+    });
+}
+
+std::string rpl_statsdebug(const std::string& nick,
+    const std::string& letter,
+    const std::string& text)
+{
+    return gen_reply({
+        _m_hostname,
+        "249",
+        nick,
+        letter,
+        ":" + text
+    });
+}
+
 std::string rpl_luserclient(const std::string &nick,
     int users_cnt, int services_cnt, int servers_cnt)
 {
@@ -419,24 +507,41 @@ std::string rpl_namreply(const std::string& nick,
     const std::string& channel,
     const std::vector<std::string>& nicks)
 {
-    std::string tailing = ":";
-    for (const auto &nick : nicks) tailing += nick + " ";
-    tailing.pop_back();
+    const auto room = namreply_room(nick.size(), channel);
+    std::vector<std::string> chunks(1);
+    for (const auto &name : nicks)
+    {
+        const auto used = chunks.back().size();
+        if (used && used + 1 + name.size() > room) chunks.emplace_back();
+        else if (used) chunks.back().push_back(' ');
+        chunks.back().append(name);
+    }
+    return rpl_namreply_chunks(nick, channel, chunks);
+}
 
-    if (channel == "*") return gen_reply({
-        _m_hostname,
-        "353",
-        nick,
-        channel,
-        channel,
-        tailing
-    });
-    else return gen_reply({
-        _m_hostname,
-        "353",
-        nick, "=", channel,
-        tailing
-    });
+std::string rpl_namreply_chunks(const std::string& nick,
+    const std::string& channel,
+    const std::vector<std::string>& chunks)
+{
+    std::string replies;
+    for (const auto &chunk : chunks)
+    {
+        replies.append(gen_reply({
+            _m_hostname,
+            "353",
+            nick, channel == "*" ? "*" : "=", channel,
+            ":" + chunk
+        }));
+    }
+    return replies;
+}
+
+std::size_t namreply_room(std::size_t nick_length,
+    const std::string& channel)
+{
+    // ":jusot.com 353 <nick> = <channel> :"
+    const auto header = _m_hostname.size() + 5 + nick_length + 3 + channel.size() + 2;
+    return header < 510 ? 510 - header : 0;
 }
 
 std::string rpl_endofnames(const std::string& nick,
@@ -529,6 +634,18 @@ std::string err_cannotsendtochan(const std::string& nick,
     });
 }
 
+std::string err_toomanytargets(const std::string& nick,
+    const std::string& target)
+{
+    return gen_reply({
+        _m_hostname,
+        "407",
+        nick,
+        target,
+        ":Too many recipients. No message delivered"
+    });
+}
+
 std::string err_norecipient(const std::string & nick,
     const std::string & command)
 {
@@ -678,6 +795,16 @@ std::string err_unknownmode(const std::string& nick,
     });
 }
 
+std::string err_noprivileges(const std::string& nick)
+{
+    return gen_reply({
+        _m_hostname,
+        "481",
+        nick,
+        ":Permission Denied- You're not an IRC operator"
+    });
+}
+
 std::string err_chanoprivsneeded(const std::string& nick,
                                  const std::string& channel)
 {
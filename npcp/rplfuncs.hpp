@@ -30,6 +30,11 @@ std::string rpl_relayed_nick(const std::string& nick,
 std::string rpl_relayed_quit(const std::string& nick,
     const std::string& user,
     const std::string& message);
+// changes is the mode string followed by its parameters, "+ov-v a b c"
+std::string rpl_relayed_mode(const std::string& nick,
+    const std::string& user,
+    const std::string& target,
+    const std::string& changes);
 
 std::string rpl_welcome(const std::string &nick,
     const std::string &user, 
@@ -41,6 +46,18 @@ std::string rpl_myinfo(const std::string& nick,
     const std::string& version,
     const std::string& avaliable_user_modes,
     const std::string& avaliable_channel_modes);            // 004
+// tokens is space-separated, "CHANTYPES=# TARGMAX=JOIN:"
+std::string rpl_isupport(const std::string& nick,
+    const std::string& tokens);                             // 005
+std::string rpl_statscommands(const std::string& nick,
+    const std::string& command,
+    long long count,
+    long long bytes);                                       // 212
+std::string rpl_endofstats(const std::string& nick,
+    const std::string& letter);                             // 219
+std::string rpl_statsdebug(const std::string& nick,
+    const std::string& letter,
+    const std::string& text);                               // 249
 std::string rpl_luserclient(const std::string& nick,
     int, int, int);                                         // 251
 std::string rpl_luserop(const std::string& nick, int);      // 252
@@ -84,9 +101,18 @@ std::string rpl_whoreply(const std::string& nick,
     const std::string& peernick,
     const std::string& flags,
     const std::string& realname);                           // 352
+// as many 353 lines as it takes to keep each within 512 bytes
 std::string rpl_namreply(const std::string& nick,
     const std::string& channel,
     const std::vector<std::string>& nicks);                 // 353
+// one 353 line per chunk of space-separated names, each short enough to fit
+// namreply_room(nick.size(), channel)
+std::string rpl_namreply_chunks(const std::string& nick,
+    const std::string& channel,
+    const std::vector<std::string>& chunks);                // 353
+// bytes left for names in a 353 line to a nick of nick_length
+std::size_t namreply_room(std::size_t nick_length,
+    const std::string& channel);
 std::string rpl_endofnames(const std::string& nick,
     const std::string& channel);                            // 366
 std::string rpl_motd(const std::string& nick,
@@ -101,6 +127,8 @@ std::string err_nosuchchannel(const std::string& nick,
     const std::string& channel);                            // 403
 std::string err_cannotsendtochan(const std::string& nick,
     const std::string& channel);                            // 404
+std::string err_toomanytargets(const std::string& nick,
+    const std::string& target);                             // 407
 std::string err_norecipient(const std::string& nick,
     const std::string& command);                            // 411
 std::string err_notexttosend(const std::string& nick);      // 412
@@ -123,6 +151,7 @@ std::string err_passwdmismatch(const std::string& nick);    // 464
 std::string err_unknownmode(const std::string& nick,
                             char mode,
                             const std::string& channel);    // 472
+std::string err_noprivileges(const std::string& nick);      // 481
 std::string err_chanoprivsneeded(const std::string& nick,
                              const std::string& channel);   // 482
 std::string err_umodeunknownflag(const std::string& nick);  // 501
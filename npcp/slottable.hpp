@@ -0,0 +1,174 @@
+#ifndef NPCP_SLOTTABLE_HPP
+#define NPCP_SLOTTABLE_HPP
+
+#include <array>
+#include <atomic>
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <optional>
+
+namespace npcp
+{
+// index in the low 32 bits, generation of the slot in the high 32 bits
+using Handle = std::uint64_t;
+constexpr Handle kNullHandle = 0;
+
+// Dense table of values addressed by generation-checked handles.
+// Slots live in fixed-size chunks that never move, and a handle whose slot
+// was erased (and maybe reused) is detected instead of aliasing the new value.
+//
+// emplace(), erase(), reclaim() and for_each() take the writers' lock, which
+// is the caller's; get() may race with them from any thread. erase() only
+// retires the value: lookups of the handle fail from then on, but the value
+// stays where it is, so a pointer another thread got before the erase is
+// still good. The caller reclaims it once no thread can be using such a
+// pointer any more, and only then is the slot reused.
+template <typename T>
+class SlotTable
+{
+  public:
+    SlotTable() : size_(0), high_(0)
+    {
+        for (auto &chunk : chunks_) chunk.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~SlotTable()
+    {
+        for (auto &chunk : chunks_) delete[] chunk.load(std::memory_order_relaxed);
+    }
+
+    SlotTable(const SlotTable&) = delete;
+    SlotTable& operator=(const SlotTable&) = delete;
+
+    template <typename... Args>
+    Handle emplace(Args&&... args)
+    {
+        std::uint32_t index;
+        if (!free_.empty())
+        {
+            index = free_.back();
+            free_.pop_back();
+        }
+        else
+        {
+            index = high_.load(std::memory_order_relaxed);
+            assert((index >> kChunkBits) < kMaxChunks);
+            auto &chunk = chunks_[index >> kChunkBits];
+            if (!chunk.load(std::memory_order_relaxed))
+                chunk.store(new Slot[kChunkSize], std::memory_order_release);
+            high_.store(index + 1, std::memory_order_release);
+        }
+
+        auto &slot = slot_at(index);
+        slot.value.emplace(std::forward<Args>(args)...);
+        slot.retired = false;
+        ++size_;
+        return (static_cast<Handle>(slot.gen.load(std::memory_order_relaxed)) << 32) | index;
+    }
+
+    // the value of a live handle, or nullptr; what it points to stays valid
+    // until the handle is reclaimed
+    T* get(Handle handle)
+    {
+        auto *slot = find(handle);
+        return slot ? &*slot->value : nullptr;
+    }
+
+    const T* get(Handle handle) const
+    {
+        return const_cast<SlotTable*>(this)->get(handle);
+    }
+
+    // retire handle, false if it isn't live; reclaim(handle) must follow
+    bool erase(Handle handle)
+    {
+        auto *slot = find(handle);
+        if (slot == nullptr) return false;
+
+        auto gen = slot->gen.load(std::memory_order_relaxed) + 1;
+        slot->gen.store(gen == 0 ? 1 : gen, std::memory_order_release);
+        slot->retired = true;
+        --size_;
+        return true;
+    }
+
+    // destroy the value of an erased handle and free its slot for reuse
+    void reclaim(Handle handle)
+    {
+        auto &slot = slot_at(static_cast<std::uint32_t>(handle));
+        assert(slot.retired);
+        slot.value.reset();
+        slot.retired = false;
+        free_.push_back(static_cast<std::uint32_t>(handle));
+    }
+
+    // live values
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    // slots allocated so far, live or free, and the free list; not what the
+    // values themselves own
+    std::size_t heap_bytes() const
+    {
+        const std::size_t chunks = (high_.load(std::memory_order_relaxed) + kChunkSize - 1) >> kChunkBits;
+        return chunks * kChunkSize * sizeof(Slot) + free_.capacity() * sizeof(std::uint32_t);
+    }
+
+    // f(Handle, T&) for every live slot
+    template <typename F>
+    void for_each(F&& f)
+    {
+        const auto high = high_.load(std::memory_order_relaxed);
+        for (std::uint32_t index = 0; index < high; ++index)
+        {
+            auto &slot = slot_at(index);
+            if (slot.value && !slot.retired)
+                f((static_cast<Handle>(slot.gen.load(std::memory_order_relaxed)) << 32) | index, *slot.value);
+        }
+    }
+
+  private:
+    static constexpr std::uint32_t kChunkBits = 10;
+    static constexpr std::uint32_t kChunkSize = 1u << kChunkBits;
+    static constexpr std::uint32_t kMaxChunks = 1u << 14;
+
+    struct Slot
+    {
+        std::atomic<std::uint32_t> gen{1};
+        bool retired = false;       // erased, not reclaimed yet; writers only
+        std::optional<T> value;
+    };
+
+    Slot& slot_at(std::uint32_t index)
+    {
+        return chunks_[index >> kChunkBits].load(std::memory_order_acquire)[index & (kChunkSize - 1)];
+    }
+
+    // A handle is only ever handed out by emplace() and erase() moves the
+    // generation past it, so a matching generation means the value is live.
+    // Readers learn of a handle through something published after the
+    // emplace, which orders the value's construction before their read.
+    Slot* find(Handle handle)
+    {
+        auto index = static_cast<std::uint32_t>(handle);
+        if (handle == kNullHandle || index >= high_.load(std::memory_order_acquire)) return nullptr;
+
+        auto &slot = slot_at(index);
+        if (slot.gen.load(std::memory_order_acquire) != static_cast<std::uint32_t>(handle >> 32))
+            return nullptr;
+        return &slot;
+    }
+
+    std::size_t size_;
+    std::atomic<std::uint32_t> high_;
+    std::vector<std::uint32_t> free_;
+    std::array<std::atomic<Slot*>, kMaxChunks> chunks_;
+};
+
+} // namespace npcp
+
+#endif // NPCP_SLOTTABLE_HPP
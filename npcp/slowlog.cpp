@@ -0,0 +1,124 @@
+#include <ctime>
+#include <fstream>
+#include <algorithm>
+
+#include "slowlog.hpp"
+#include "message.hpp"
+
+namespace
+{
+constexpr std::size_t kMaxArgs = 5;
+constexpr std::size_t kMaxArgBytes = 32;
+
+// "WHO *" or "PRIVMSG #a,#b,#c,#d... (12 more bytes) ... (3 more arguments)"
+std::string summarize(const npcp::Message& msg)
+{
+    std::string text = msg.command();
+    const auto &args = msg.args();
+    for (std::size_t i = 0; i < args.size() && i < kMaxArgs; ++i)
+    {
+        text.push_back(' ');
+        // never keep a password around
+        if ((msg.command() == "OPER" && i == 1) || msg.command() == "PASS")
+        {
+            text.append("<hidden>");
+            continue;
+        }
+        if (args[i].size() <= kMaxArgBytes)
+            text.append(args[i]);
+        else
+            text.append(args[i], 0, kMaxArgBytes)
+                .append("... (" + std::to_string(args[i].size() - kMaxArgBytes) + " more bytes)");
+    }
+    if (args.size() > kMaxArgs)
+        text.append(" ... (" + std::to_string(args.size() - kMaxArgs) + " more arguments)");
+    return text;
+}
+} // namespace
+
+namespace npcp
+{
+Slowlog::Slowlog(std::size_t capacity, std::int64_t threshold_ns)
+  : threshold_ns_(threshold_ns),
+    capacity_(capacity ? capacity : 1),
+    next_(0),
+    next_id_(0)
+{
+}
+
+void Slowlog::record(const Message &msg, const std::string &nick, std::size_t loop,
+    std::int64_t duration_ns, std::int64_t bytes_out)
+{
+    Entry entry{ 0, std::time(nullptr), duration_ns, loop, bytes_out, nick, summarize(msg) };
+
+    std::lock_guard lock(mutex_);
+    entry.id = next_id_++;
+    if (ring_.size() < capacity_)
+        ring_.push_back(std::move(entry));
+    else
+        ring_[next_] = std::move(entry);
+    next_ = (next_ + 1) % capacity_;
+}
+
+std::vector<Slowlog::Entry> Slowlog::entries(std::size_t count) const
+{
+    std::lock_guard lock(mutex_);
+    std::vector<Entry> result;
+    count = std::min(count, ring_.size());
+    result.reserve(count);
+    for (std::size_t i = 1; i <= count; ++i)
+        result.push_back(ring_[(next_ + capacity_ - i) % capacity_]);
+    return result;
+}
+
+std::size_t Slowlog::size() const
+{
+    std::lock_guard lock(mutex_);
+    return ring_.size();
+}
+
+void Slowlog::reset()
+{
+    std::lock_guard lock(mutex_);
+    ring_.clear();
+    next_ = 0;
+}
+
+void Slowlog::set_capacity(std::size_t capacity)
+{
+    std::lock_guard lock(mutex_);
+    capacity_ = capacity ? capacity : 1;
+    ring_.clear();
+    next_ = 0;
+}
+
+std::size_t Slowlog::capacity() const
+{
+    std::lock_guard lock(mutex_);
+    return capacity_;
+}
+
+bool Slowlog::dump(const std::string &path) const
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) return false;
+    for (const auto &entry : entries(capacity()))
+        out << describe(entry) << '\n';
+    return static_cast<bool>(out);
+}
+
+std::string Slowlog::describe(const Entry &entry)
+{
+    char when[32];
+    std::tm tm;
+    gmtime_r(&entry.time, &tm);
+    std::strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    return "#" + std::to_string(entry.id) + " " + when +
+        " " + std::to_string(entry.duration_ns / 1000) + "us" +
+        " loop " + std::to_string(entry.loop) +
+        " out " + std::to_string(entry.bytes_out) + " bytes" +
+        " " + entry.nick + ": " + entry.command;
+}
+
+} // namespace npcp
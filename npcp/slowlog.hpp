@@ -0,0 +1,73 @@
+#ifndef NPCP_SLOWLOG_HPP
+#define NPCP_SLOWLOG_HPP
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace npcp
+{
+class Message;
+
+// Commands whose handler ran longer than a threshold, newest kept, like the
+// Redis slowlog. Checking the threshold is one relaxed load; only commands
+// that are already slow pay for the lock and the copies.
+class Slowlog
+{
+  public:
+    struct Entry
+    {
+        std::uint64_t id;
+        std::int64_t time;              // unix seconds
+        std::int64_t duration_ns;
+        std::size_t loop;
+        std::int64_t bytes_out;
+        std::string nick;
+        std::string command;            // with its arguments, truncated
+    };
+
+    Slowlog(std::size_t capacity, std::int64_t threshold_ns);
+
+    Slowlog(const Slowlog&) = delete;
+    Slowlog& operator=(const Slowlog&) = delete;
+
+    bool slow(std::int64_t duration_ns) const
+    {
+        return duration_ns >= threshold_ns_.load(std::memory_order_relaxed);
+    }
+
+    void record(const Message& msg, const std::string& nick, std::size_t loop,
+        std::int64_t duration_ns, std::int64_t bytes_out);
+
+    // at most count entries, newest first
+    std::vector<Entry> entries(std::size_t count) const;
+    std::size_t size() const;
+    void reset();
+
+    void set_threshold(std::int64_t ns) { threshold_ns_.store(ns, std::memory_order_relaxed); }
+    std::int64_t threshold() const { return threshold_ns_.load(std::memory_order_relaxed); }
+
+    // drops every entry
+    void set_capacity(std::size_t capacity);
+    std::size_t capacity() const;
+
+    // one line per entry, newest first; false if path can't be written
+    bool dump(const std::string& path) const;
+
+    static std::string describe(const Entry& entry);
+
+  private:
+    std::atomic<std::int64_t> threshold_ns_;
+
+    mutable std::mutex mutex_;
+    std::size_t capacity_;
+    std::vector<Entry> ring_;
+    std::size_t next_;                  // slot the next entry goes to
+    std::uint64_t next_id_;
+};
+
+} // namespace npcp
+
+#endif // NPCP_SLOWLOG_HPP
@@ -0,0 +1,246 @@
+#include <map>
+#include <array>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "trace.hpp"
+#include "metrics.hpp"
+
+namespace
+{
+using npcp::trace::Kind;
+
+constexpr std::size_t kRingSize = 1 << 15;
+
+// fields are relaxed atomics so a reader racing the owner is merely stale
+struct Event
+{
+    std::atomic<std::uint64_t> trace{0};
+    std::atomic<std::int64_t> ns{0};
+    std::atomic<std::uint64_t> arg{0};
+    std::atomic<std::uint32_t> kind{0};
+};
+
+struct Ring
+{
+    std::size_t loop = 0;
+    std::atomic<std::uint64_t> head{0};
+    std::array<Event, kRingSize> events;
+
+    // owner only
+    std::uint64_t lines = 0;
+    std::uint64_t seq = 0;
+};
+
+struct Copy
+{
+    std::uint64_t trace;
+    std::int64_t ns;
+    std::uint64_t arg;
+    Kind kind;
+    std::size_t loop;
+};
+
+// rings are never freed, I/O threads live as long as the server
+std::mutex g_rings_mutex;
+std::vector<Ring*> g_rings;
+
+std::mutex g_path_mutex;
+std::string g_path = "./trace.json";
+std::atomic<bool> g_dump_requested{false};
+
+thread_local std::uint64_t t_current = 0;
+
+Ring& ring()
+{
+    thread_local Ring* ring = [] {
+        auto *r = new Ring;
+        r->loop = npcp::metrics::local().id;
+        std::lock_guard lock(g_rings_mutex);
+        g_rings.push_back(r);
+        return r;
+    }();
+    return *ring;
+}
+
+// The owner publishes head after filling a slot, so the slot it may be
+// rewriting right now is the oldest one a reader sees; that one is skipped,
+// and whatever got overwritten while copying is dropped afterwards.
+void copy_ring(const Ring& ring, std::vector<Copy>& out)
+{
+    const auto head = ring.head.load(std::memory_order_acquire);
+    const auto first = head >= kRingSize ? head - kRingSize + 1 : 0;
+    const auto begin = out.size();
+    for (auto i = first; i < head; ++i)
+    {
+        const auto &e = ring.events[i % kRingSize];
+        out.push_back({ e.trace.load(std::memory_order_relaxed), e.ns.load(std::memory_order_relaxed),
+            e.arg.load(std::memory_order_relaxed), static_cast<Kind>(e.kind.load(std::memory_order_relaxed)),
+            ring.loop });
+    }
+
+    const auto now = ring.head.load(std::memory_order_acquire);
+    const auto valid = now >= kRingSize ? now - kRingSize + 1 : 0;
+    if (valid > first)
+        out.erase(out.begin() + begin, out.begin() + begin + std::min(valid - first, head - first));
+}
+
+void complete(std::ostringstream& out, bool& first, const char* name, std::int64_t start_ns,
+    std::int64_t end_ns, std::int64_t origin_ns, std::size_t loop, const std::string& args)
+{
+    out << (first ? "" : ",\n") << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << loop
+        << ",\"ts\":" << (start_ns - origin_ns) / 1000.0 << ",\"dur\":" << (end_ns - start_ns) / 1000.0
+        << ",\"args\":{" << args << "}}";
+    first = false;
+}
+} // namespace
+
+namespace npcp
+{
+namespace trace
+{
+std::atomic<std::uint32_t> g_sample_every{0};
+
+void configure(std::uint32_t every, std::string path)
+{
+    g_sample_every.store(every, std::memory_order_relaxed);
+    std::lock_guard lock(g_path_mutex);
+    g_path = std::move(path);
+}
+
+std::uint64_t sample()
+{
+    const auto every = g_sample_every.load(std::memory_order_relaxed);
+    if (every == 0) return 0;
+
+    auto &r = ring();
+    if (++r.lines % every) return 0;
+    return (static_cast<std::uint64_t>(r.loop + 1) << 48) | ++r.seq;
+}
+
+void record(std::uint64_t trace, Kind kind, std::uint64_t arg, std::int64_t ns)
+{
+    auto &r = ring();
+    const auto head = r.head.load(std::memory_order_relaxed);
+    auto &e = r.events[head % kRingSize];
+    e.trace.store(trace, std::memory_order_relaxed);
+    e.ns.store(ns, std::memory_order_relaxed);
+    e.arg.store(arg, std::memory_order_relaxed);
+    e.kind.store(kind, std::memory_order_relaxed);
+    r.head.store(head + 1, std::memory_order_release);
+}
+
+void record(std::uint64_t trace, Kind kind, std::uint64_t arg)
+{
+    record(trace, kind, arg, metrics::now_ns());
+}
+
+std::uint64_t current()
+{
+    return t_current;
+}
+
+void set_current(std::uint64_t trace)
+{
+    t_current = trace;
+}
+
+std::string to_chrome_json()
+{
+    std::vector<Copy> events;
+    {
+        std::lock_guard lock(g_rings_mutex);
+        for (const auto *r : g_rings) copy_ring(*r, events);
+    }
+
+    std::map<std::uint64_t, std::vector<const Copy*>> traces;
+    std::int64_t origin = INT64_MAX;
+    std::vector<std::size_t> loops;
+    for (const auto &e : events)
+    {
+        traces[e.trace].push_back(&e);
+        origin = std::min(origin, e.ns);
+        if (std::find(loops.begin(), loops.end(), e.loop) == loops.end()) loops.push_back(e.loop);
+    }
+
+    std::ostringstream out;
+    bool first = true;
+    out << "{\"traceEvents\":[\n";
+    for (auto loop : loops)
+    {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << loop
+            << ",\"args\":{\"name\":\"loop " << loop << "\"}}";
+        first = false;
+    }
+
+    for (auto &[id, list] : traces)
+    {
+        std::sort(list.begin(), list.end(), [] (const Copy* a, const Copy* b) { return a->ns < b->ns; });
+
+        const Copy *read = nullptr, *parsed = nullptr, *start = nullptr, *end = nullptr;
+        std::vector<const Copy*> enqueued;
+        for (const auto *e : list)
+        {
+            switch (e->kind)
+            {
+                case kRead:         read = e; break;
+                case kParsed:       parsed = e; break;
+                case kHandlerStart: start = e; break;
+                case kHandlerEnd:   end = e; break;
+                case kEnqueue:      enqueued.push_back(e); break;
+                default:            break;
+            }
+        }
+        // the head of this trace was overwritten already
+        if (!read || !parsed || !start || !end) continue;
+
+        const auto command = std::string("\"trace\":") + std::to_string(id) +
+            ",\"command\":\"" + metrics::command_name(parsed->arg) + "\"";
+        complete(out, first, "parse", read->ns, parsed->ns, origin, read->loop, command);
+        complete(out, first, "handle", start->ns, end->ns, origin, start->loop,
+            command + ",\"recipients\":" + std::to_string(enqueued.size()));
+
+        for (const auto *w : list)
+        {
+            if (w->kind != kWrite) continue;
+            auto it = std::find_if(enqueued.begin(), enqueued.end(),
+                [w] (const Copy* q) { return q && q->arg == w->arg; });
+            if (it == enqueued.end()) continue;
+            complete(out, first, (*it)->loop == w->loop ? "deliver" : "deliver (cross-loop)",
+                (*it)->ns, w->ns, origin, w->loop,
+                command + ",\"recipient\":" + std::to_string(w->arg));
+            *it = nullptr;
+        }
+    }
+    out << "\n]}\n";
+    return out.str();
+}
+
+std::string dump_path()
+{
+    std::lock_guard lock(g_path_mutex);
+    return g_path;
+}
+
+bool dump()
+{
+    std::ofstream out(dump_path(), std::ios::trunc);
+    out << to_chrome_json();
+    return static_cast<bool>(out);
+}
+
+void request_dump()
+{
+    g_dump_requested.store(true, std::memory_order_relaxed);
+}
+
+void poll_dump()
+{
+    if (g_dump_requested.exchange(false, std::memory_order_relaxed)) dump();
+}
+
+} // namespace trace
+} // namespace npcp
@@ -0,0 +1,61 @@
+#ifndef NPCP_TRACE_HPP
+#define NPCP_TRACE_HPP
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+namespace npcp
+{
+namespace trace
+{
+// Points a sampled line passes on its way through the server. icarus doesn't
+// hand us the time a read returned, so kRead is when on_message was called.
+enum Kind : std::uint32_t
+{
+    kRead,
+    kParsed,            // arg: metrics::Command
+    kHandlerStart,
+    kHandlerEnd,
+    kEnqueue,           // arg: recipient handle, on the sender's loop
+    kWrite,             // arg: recipient handle, TcpConnection::send on its own loop
+};
+
+extern std::atomic<std::uint32_t> g_sample_every;
+
+// trace one line in every n, 0 turns tracing off; dump() writes to path
+void configure(std::uint32_t every, std::string path);
+
+inline bool enabled()
+{
+    return g_sample_every.load(std::memory_order_relaxed) != 0;
+}
+
+// id for the line about to be handled on this thread, 0 if it isn't sampled
+std::uint64_t sample();
+
+// Appends to the calling thread's ring, which only that thread writes;
+// the oldest events are overwritten once it is full.
+void record(std::uint64_t trace, Kind kind, std::uint64_t arg, std::int64_t ns);
+void record(std::uint64_t trace, Kind kind, std::uint64_t arg = 0);
+
+// the sampled line the calling thread is handling, 0 if none
+std::uint64_t current();
+void set_current(std::uint64_t trace);
+
+// every complete trace in the rings as Chrome trace JSON (chrome://tracing,
+// Perfetto), one thread per loop
+std::string to_chrome_json();
+
+// writes to_chrome_json() to the configured path; false if it can't
+bool dump();
+std::string dump_path();
+
+// async-signal-safe; the dump happens at the next poll_dump()
+void request_dump();
+void poll_dump();
+
+} // namespace trace
+} // namespace npcp
+
+#endif // NPCP_TRACE_HPP
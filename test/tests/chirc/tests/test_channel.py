@@ -100,6 +100,72 @@ class TestJOIN(object):
                                                  expect_nick="user1", expect_cmd="JOIN")
 
 
+    def test_join_multiple(self, irc_session):
+        """
+        Two clients join #test1 and #test2 with a single JOIN each.
+        Each channel is joined in the order given, with its own JOIN,
+        RPL_NAMREPLY and RPL_ENDOFNAMES, and the first client sees
+        the second one join both.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+        client2 = irc_session.connect_user("user2", "User Two")
+
+        client1.send_cmd("JOIN #test1,#test2")
+        irc_session.verify_join(client1, "user1", "#test1", expect_names = ["@user1"])
+        irc_session.verify_join(client1, "user1", "#test2", expect_names = ["@user1"])
+
+        client2.send_cmd("JOIN #test1,#test2")
+        irc_session.verify_join(client2, "user2", "#test1", expect_names = ["@user1", "user2"])
+        irc_session.verify_join(client2, "user2", "#test2", expect_names = ["@user1", "user2"])
+
+        irc_session.verify_relayed_join(client1, from_nick="user2", channel="#test1")
+        irc_session.verify_relayed_join(client1, from_nick="user2", channel="#test2")
+
+
+    def test_join_zero(self, irc_session):
+        """
+        user1 is in #test1 and #test2, and user2 in #test2 only. user1
+        sends "JOIN 0", which parts every channel it is in, so both
+        get a PART for each channel user1 shared with them.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+        client2 = irc_session.connect_user("user2", "User Two")
+
+        client1.send_cmd("JOIN #test1,#test2")
+        irc_session.verify_join(client1, "user1", "#test1")
+        irc_session.verify_join(client1, "user1", "#test2")
+
+        client2.send_cmd("JOIN #test2")
+        irc_session.verify_join(client2, "user2", "#test2")
+        irc_session.verify_relayed_join(client1, from_nick="user2", channel="#test2")
+
+        client1.send_cmd("JOIN 0")
+        irc_session.verify_relayed_part(client1, from_nick="user1", channel="#test1", msg=None)
+        irc_session.verify_relayed_part(client1, from_nick="user1", channel="#test2", msg=None)
+        irc_session.verify_relayed_part(client2, from_nick="user1", channel="#test2", msg=None)
+        irc_session.get_reply(client2, expect_timeout = True)
+
+        client1.send_cmd("PART #test1")
+        irc_session.get_reply(client1, expect_code = replies.ERR_NOSUCHCHANNEL, expect_nick = "user1",
+                              expect_nparams = 2, expect_short_params = ["#test1"],
+                              long_param_re = "No such channel")
+
+
+    def test_join_notargets(self, irc_session):
+        """
+        A JOIN whose channel list is only commas names no channel,
+        so it gets ERR_NEEDMOREPARAMS like a JOIN without one.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+
+        client1.send_cmd("JOIN ,")
+        irc_session.get_ERR_NEEDMOREPARAMS_reply(client1,
+                                                 expect_nick="user1", expect_cmd="JOIN")
+
+
 @pytest.mark.category("CHANNEL_PRIVMSG_NOTICE")
 class TestChannelPRIVMSG(object):
     
@@ -177,6 +243,41 @@ class TestChannelPRIVMSG(object):
                        long_param_re = "Cannot send to channel")          
           
 
+    def test_channel_privmsg_multiple(self, irc_session):
+        """
+        user1 sends a PRIVMSG to #test1 and #test2. user2 is in both
+        channels and gets the message once, addressed to the first of
+        them. user3, only in #test2, gets it addressed to #test2.
+        """
+
+        users = irc_session.connect_and_join_channels({"#test1": ["@user1", "user2"],
+                                                       "#test2": ["@user1", "user2", "user3"]})
+
+        users["user1"].send_cmd("PRIVMSG #test1,#test2 :Hello")
+        irc_session.verify_relayed_privmsg(users["user2"], from_nick="user1", recip="#test1", msg="Hello")
+        irc_session.verify_relayed_privmsg(users["user3"], from_nick="user1", recip="#test2", msg="Hello")
+
+        for nick in ("user1", "user2", "user3"):
+            irc_session.get_reply(users[nick], expect_timeout = True)
+
+
+    def test_channel_privmsg_channel_and_nick(self, irc_session):
+        """
+        user2 sends a PRIVMSG to #test and to user1, who is in #test.
+        A nick named in the target list always gets its own copy, so
+        user1 gets the message once through #test and once directly.
+        """
+
+        clients = irc_session.connect_clients(2, join_channel = "#test")
+        client1 = clients[0][1]
+        client2 = clients[1][1]
+
+        client2.send_cmd("PRIVMSG #test,user1 :Hello")
+        irc_session.verify_relayed_privmsg(client1, from_nick="user2", recip="#test", msg="Hello")
+        irc_session.verify_relayed_privmsg(client1, from_nick="user2", recip="user1", msg="Hello")
+        irc_session.get_reply(client2, expect_timeout = True)
+
+
 @pytest.mark.category("CHANNEL_PRIVMSG_NOTICE")        
 class TestChannelNOTICE(object):     
     
@@ -194,6 +295,21 @@ class TestChannelNOTICE(object):
         irc_session.get_reply(client1, expect_timeout = True)
         
         
+    def test_channel_notice_multiple(self, irc_session):
+        """
+        user1 sends a NOTICE to #test1 and #test2. user2 is in both
+        channels and gets the notice once.
+        """
+
+        users = irc_session.connect_and_join_channels({"#test1": ["@user1", "user2"],
+                                                       "#test2": ["@user1", "user2"]})
+
+        users["user1"].send_cmd("NOTICE #test1,#test2 :Hello")
+        irc_session.verify_relayed_notice(users["user2"], from_nick="user1", recip="#test1", msg="Hello")
+        irc_session.get_reply(users["user2"], expect_timeout = True)
+        irc_session.get_reply(users["user1"], expect_timeout = True)
+
+
 @pytest.mark.category("CHANNEL_PART")
 class TestPART(object):
     def _test_join_and_part(self, irc_session, numclients):
@@ -318,6 +434,43 @@ class TestPART(object):
         self._test_join_and_part_and_join_and_part(irc_session, 10)
 
 
+    def test_channel_part_multiple(self, irc_session):
+        """
+        user1 and user2 are in #test1 and #test2. user1 leaves both
+        with a single PART, and both users get a PART for each channel,
+        in the order given, carrying the same message.
+        """
+
+        users = irc_session.connect_and_join_channels({"#test1": ["@user1", "user2"],
+                                                       "#test2": ["@user1", "user2"]})
+
+        users["user1"].send_cmd("PART #test1,#test2 :Goodbye")
+        for nick in ("user1", "user2"):
+            irc_session.verify_relayed_part(users[nick], from_nick="user1", channel="#test1", msg="Goodbye")
+            irc_session.verify_relayed_part(users[nick], from_nick="user1", channel="#test2", msg="Goodbye")
+
+        users["user2"].send_cmd("PRIVMSG #test1,#test2 :Still here")
+        irc_session.get_reply(users["user1"], expect_timeout = True)
+
+
+    def test_channel_part_notargets(self, irc_session):
+        """
+        A PART whose channel list is only commas names no channel,
+        so it gets ERR_NEEDMOREPARAMS and user1 stays in #test.
+        """
+
+        clients = irc_session.connect_clients(2, join_channel = "#test")
+        client1 = clients[0][1]
+        client2 = clients[1][1]
+
+        client1.send_cmd("PART ,, :Goodbye")
+        irc_session.get_ERR_NEEDMOREPARAMS_reply(client1,
+                                                 expect_nick="user1", expect_cmd="PART")
+
+        client1.send_cmd("PRIVMSG #test :Still here")
+        irc_session.verify_relayed_privmsg(client2, from_nick="user1", recip="#test", msg="Still here")
+
+
     def test_channel_part_nochannel1(self, irc_session):
         """
         A client connects to the server and tries to leave a channel
@@ -862,7 +1015,79 @@ class TestNAMES(object):
         
         users["user1"].send_cmd("NAMES #noexist")
         irc_session.get_reply(users["user1"], expect_code = replies.RPL_ENDOFNAMES, expect_nick = "user1",
-                   expect_nparams = 2)                
+                   expect_nparams = 2)
+
+
+    def _get_names_split(self, irc_session, client, nick, channel):
+        """
+        Reads RPL_NAMREPLY replies for `channel` up to and including
+        RPL_ENDOFNAMES, checking that none of them exceeds 512 bytes.
+        Returns the number of RPL_NAMREPLY replies and the names in them.
+        """
+        nlines = 0
+        names = []
+        while True:
+            reply = irc_session.get_reply(client, expect_nick = nick)
+            if reply.cmd == replies.RPL_ENDOFNAMES:
+                break
+            assert reply.cmd == replies.RPL_NAMREPLY, "Expected RPL_NAMREPLY or RPL_ENDOFNAMES: {}".format(reply._s)
+            irc_session.verify_names_single(reply, nick, expect_channel = channel)
+            assert len(reply._s) + 2 <= 512, "RPL_NAMREPLY is longer than 512 bytes: {}".format(reply._s)
+            nlines += 1
+            names += reply.params[3][1:].split(" ")
+        return nlines, names
+
+    def _assert_names(self, names, expect_names):
+        assert sorted(names) == sorted(expect_names), \
+            "Expected names {}, got {}".format(" ".join(sorted(expect_names)), " ".join(sorted(names)))
+
+    def test_names12(self, irc_session):
+        """
+        Twelve users with 50-character nicks join #test, which is more
+        than fits in a single RPL_NAMREPLY. Every JOIN and a NAMES from
+        the channel operator must split the list across several replies,
+        none longer than 512 bytes, that together list each member once.
+
+        One member then changes nick and another is given voice, and
+        NAMES must show the new nick and the '+' from then on.
+        """
+        nicks = ["user%02d" % (i+1) + "x" * 44 for i in range(12)]
+        clients = [irc_session.connect_user(nick, nick) for nick in nicks]
+
+        joined = []
+        for nick, client in zip(nicks, clients):
+            client.send_cmd("JOIN #test")
+            irc_session.verify_relayed_join(client, nick, "#test")
+            nlines, names = self._get_names_split(irc_session, client, nick, "#test")
+            joined.append(nick)
+            self._assert_names(names, ["@" + joined[0]] + joined[1:])
+            for other in clients[:len(joined)-1]:
+                irc_session.verify_relayed_join(other, nick, "#test")
+
+        expect_names = ["@" + nicks[0]] + nicks[1:]
+        clients[0].send_cmd("NAMES #test")
+        nlines, names = self._get_names_split(irc_session, clients[0], nicks[0], "#test")
+        assert nlines > 1, "Expected the names to be split across several RPL_NAMREPLY replies"
+        self._assert_names(names, expect_names)
+
+        newnick = "renamed" + "x" * 43
+        clients[3].send_cmd("NICK %s" % newnick)
+        for client in clients:
+            irc_session.verify_relayed_nick(client, nicks[3], newnick)
+        expect_names[3] = newnick
+
+        clients[0].send_cmd("NAMES #test")
+        nlines, names = self._get_names_split(irc_session, clients[0], nicks[0], "#test")
+        self._assert_names(names, expect_names)
+
+        irc_session.set_channel_mode(clients[0], nicks[0], "#test", "+v", nicks[5])
+        for client in clients:
+            irc_session.verify_relayed_mode(client, nicks[0], "#test", "+v", nicks[5])
+        expect_names[5] = "+" + nicks[5]
+
+        clients[7].send_cmd("NAMES #test")
+        nlines, names = self._get_names_split(irc_session, clients[7], nicks[7], "#test")
+        self._assert_names(names, expect_names)
 
 
 @pytest.mark.category("LIST")                
@@ -1275,6 +1500,33 @@ class TestChannelUPDATEAssignment2(object):
             irc_session.verify_relayed_nick(client, from_nick=nick1, newnick="userfoo")         
             
 
+    def test_update1b_shared_channels(self, irc_session):
+        """
+        Two users share three channels. When one changes nick, the other
+        must get the NICK once, not once per shared channel, and the user
+        itself must get its own NICK once. The same goes for its QUIT.
+        """
+        users = irc_session.connect_and_join_channels({"#test1": ["@user1", "user2"],
+                                                       "#test2": ["@user1", "user2"],
+                                                       "#test3": ["@user2", "user1"]})
+
+        users["user1"].send_cmd("NICK userfoo")
+
+        for client in (users["user1"], users["user2"]):
+            irc_session.verify_relayed_nick(client, from_nick="user1", newnick="userfoo")
+            irc_session.get_reply(client, expect_timeout = True)
+
+        users["user1"].send_cmd("QUIT")
+
+        irc_session.verify_relayed_quit(users["user2"], from_nick="userfoo", msg = "Client Quit")
+        irc_session.get_reply(users["user2"], expect_timeout = True)
+
+        irc_session.get_message(users["user1"], expect_cmd = "ERROR", expect_nparams = 1,
+                                long_param_re = "Closing Link: .* \(Client Quit\)")
+
+        irc_session.verify_disconnect(users["user1"])
+
+
     def test_update1b_quit1(self, irc_session):
         """
         Ensure that a user's QUIT is relayed to the channels the user is in.
@@ -664,6 +664,116 @@ class TestMODE(object):
                                                  expect_nick="user1", expect_cmd="MODE")           
     
 
+    def _verify_mode_line(self, irc_session, clients, line):
+        """
+        Verifies that every one of `clients` receives exactly `line`
+        (without the trailing CRLF) as the relayed MODE
+        """
+        for nick, client in clients:
+            reply = irc_session.get_message(client, expect_prefix = True, expect_cmd = "MODE")
+            assert reply._s == line, "Expected relayed MODE '{}', got '{}'".format(line, reply._s)
+
+    def _verify_unknown_mode(self, irc_session, client, nick, channel, letter):
+        irc_session.get_reply(client, expect_code = replies.ERR_UNKNOWNMODE, expect_nick = nick,
+                              expect_nparams = 2, expect_short_params = [letter],
+                              long_param_re = "is unknown mode char to me for (?P<channel>.+)",
+                              long_param_values = {"channel":channel})
+
+    def test_channel_mode_string01(self, irc_session):
+        """
+        The operator of #test sets two channel modes and two member
+        statuses in one MODE. Everyone in the channel gets a single MODE
+        listing all four, with the nicks in the order they were given.
+        """
+        clients = irc_session.connect_clients(3, join_channel = "#test")
+        nick1, client1 = clients[0]
+
+        client1.send_cmd("MODE #test +mtov user2 user3")
+        self._verify_mode_line(irc_session, clients, ":user1!user1@jusot.com MODE #test +mtov user2 user3")
+
+        irc_session.set_channel_mode(client1, nick1, "#test", expect_mode = "mt")
+
+    def test_channel_mode_string02(self, irc_session):
+        """
+        A mode string that switches between '+' and '-' more than once.
+        The relayed MODE keeps each switch and pairs the member status
+        changes with their nicks in order.
+        """
+        clients = irc_session.connect_clients(3, join_channel = "#test")
+        nick1, client1 = clients[0]
+
+        client1.send_cmd("MODE #test +t")
+        self._verify_mode_line(irc_session, clients, ":user1!user1@jusot.com MODE #test +t")
+
+        client1.send_cmd("MODE #test -t+m")
+        self._verify_mode_line(irc_session, clients, ":user1!user1@jusot.com MODE #test -t+m")
+        irc_session.set_channel_mode(client1, nick1, "#test", expect_mode = "m")
+
+        client1.send_cmd("MODE #test +v-m+o-v user2 user3 user2")
+        self._verify_mode_line(irc_session, clients, ":user1!user1@jusot.com MODE #test +v-m+o-v user2 user3 user2")
+        irc_session.set_channel_mode(client1, nick1, "#test", expect_mode = "")
+
+        client1.send_cmd("NAMES #test")
+        irc_session.verify_names(client1, nick1, expect_channel = "#test",
+                                 expect_names = ["@user1", "user2", "@user3"])
+
+    def test_channel_mode_string03(self, irc_session):
+        """
+        Member status letters without a nick left to go with them get
+        ERR_UNKNOWNMODE, while the rest of the string is still applied.
+        A string in which nothing is left to apply is not relayed.
+        """
+        clients = irc_session.connect_clients(2, join_channel = "#test")
+        nick1, client1 = clients[0]
+
+        client1.send_cmd("MODE #test +ov user2")
+        self._verify_unknown_mode(irc_session, client1, nick1, "#test", "v")
+        self._verify_mode_line(irc_session, clients, ":user1!user1@jusot.com MODE #test +o user2")
+
+        client1.send_cmd("MODE #test +o")
+        self._verify_unknown_mode(irc_session, client1, nick1, "#test", "o")
+        for nick, client in clients:
+            irc_session.get_reply(client, expect_timeout = True)
+
+    def test_channel_mode_string04(self, irc_session):
+        """
+        Unknown mode letters get one ERR_UNKNOWNMODE each, and the
+        known letters around them are still applied and relayed.
+        """
+        clients = irc_session.connect_clients(2, join_channel = "#test")
+        nick1, client1 = clients[0]
+
+        client1.send_cmd("MODE #test +mzt")
+        self._verify_unknown_mode(irc_session, client1, nick1, "#test", "z")
+        self._verify_mode_line(irc_session, clients, ":user1!user1@jusot.com MODE #test +mt")
+        irc_session.set_channel_mode(client1, nick1, "#test", expect_mode = "mt")
+
+        client1.send_cmd("MODE #test -zq")
+        self._verify_unknown_mode(irc_session, client1, nick1, "#test", "z")
+        self._verify_unknown_mode(irc_session, client1, nick1, "#test", "q")
+        for nick, client in clients:
+            irc_session.get_reply(client, expect_timeout = True)
+
+    def test_channel_mode_string05(self, irc_session):
+        """
+        A nick in the mode string that is not in the channel gets
+        ERR_USERNOTINCHANNEL, and only the changes that did apply
+        are relayed.
+        """
+        clients = irc_session.connect_clients(2, join_channel = "#test")
+        nick1, client1 = clients[0]
+        irc_session.connect_user("user3", "User Three")
+
+        client1.send_cmd("MODE #test +vv-o user3 user2 user9")
+        irc_session.get_reply(client1, expect_code = replies.ERR_USERNOTINCHANNEL, expect_nick = nick1,
+                              expect_nparams = 3, expect_short_params = ["user3", "#test"],
+                              long_param_re = "They aren't on that channel")
+        irc_session.get_reply(client1, expect_code = replies.ERR_USERNOTINCHANNEL, expect_nick = nick1,
+                              expect_nparams = 3, expect_short_params = ["user9", "#test"],
+                              long_param_re = "They aren't on that channel")
+        self._verify_mode_line(irc_session, clients, ":user1!user1@jusot.com MODE #test +v user2")
+
+
     def test_connect_channels01(self, irc_session):
         """
         Connects nine users to the server, and has them join
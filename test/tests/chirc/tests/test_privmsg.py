@@ -157,6 +157,70 @@ class TestPRIVMSG(object):
                               expect_nparams = 1, long_param_re = "No recipient given \(PRIVMSG\)")     
         
 
+    def test_privmsg_targets1(self, irc_session):
+        """
+        user1 sends one PRIVMSG to user2 and user3, and each of them
+        gets it addressed to their own nick.
+        """
+
+        clients = irc_session.connect_clients(3)
+        client1 = clients[0][1]
+
+        client1.send_cmd("PRIVMSG user2,user3 :Hello")
+        irc_session.verify_relayed_privmsg(clients[1][1], from_nick="user1", recip="user2", msg="Hello")
+        irc_session.verify_relayed_privmsg(clients[2][1], from_nick="user1", recip="user3", msg="Hello")
+        irc_session.get_reply(client1, expect_timeout = True)
+
+
+    def test_privmsg_targets2(self, irc_session):
+        """
+        user1 sends a PRIVMSG to user2 and to a nick that doesn't
+        exist. user2 gets the message, and user1 gets ERR_NOSUCHNICK
+        for the other nick only.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+        client2 = irc_session.connect_user("user2", "User Two")
+
+        client1.send_cmd("PRIVMSG user2,user3 :Hello")
+        irc_session.verify_relayed_privmsg(client2, from_nick="user1", recip="user2", msg="Hello")
+        irc_session.get_reply(client1, expect_code = replies.ERR_NOSUCHNICK, expect_nick = "user1",
+                              expect_nparams = 2, expect_short_params = ["user3"],
+                              long_param_re = "No such nick/channel")
+
+
+    def test_privmsg_toomanytargets(self, irc_session):
+        """
+        user1 sends a PRIVMSG to five users, one more than the server
+        allows. user1 gets a single ERR_TOOMANYTARGETS naming the fifth
+        target, and nobody gets the message.
+        """
+
+        clients = irc_session.connect_clients(6)
+        client1 = clients[0][1]
+
+        client1.send_cmd("PRIVMSG user2,user3,user4,user5,user6 :Hello")
+        irc_session.get_reply(client1, expect_code = replies.ERR_TOOMANYTARGETS, expect_nick = "user1",
+                              expect_nparams = 2, expect_short_params = ["user6"],
+                              long_param_re = "Too many recipients. No message delivered")
+
+        for nick, client in clients:
+            irc_session.get_reply(client, expect_timeout = True)
+
+
+    def test_privmsg_notargets(self, irc_session):
+        """
+        A PRIVMSG whose target list is only commas names no one,
+        so it gets ERR_NORECIPIENT like a PRIVMSG without one.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+
+        client1.send_cmd("PRIVMSG , :Hello")
+        irc_session.get_reply(client1, expect_code = replies.ERR_NORECIPIENT, expect_nick = "user1",
+                              expect_nparams = 1, long_param_re = "No recipient given \\(PRIVMSG\\)")
+
+
 @pytest.mark.category("PRIVMSG_NOTICE")
 class TestNOTICE(object):
     
@@ -205,4 +269,47 @@ class TestNOTICE(object):
 
         irc_session.get_reply(client1, expect_timeout = True)        
 
-    
\ No newline at end of file
+    
+
+
+    def test_notice_targets(self, irc_session):
+        """
+        user1 sends one NOTICE to user2 and user3, and each of them
+        gets it addressed to their own nick.
+        """
+
+        clients = irc_session.connect_clients(3)
+        client1 = clients[0][1]
+
+        client1.send_cmd("NOTICE user2,user3 :Hello")
+        irc_session.verify_relayed_notice(clients[1][1], from_nick="user1", recip="user2", msg="Hello")
+        irc_session.verify_relayed_notice(clients[2][1], from_nick="user1", recip="user3", msg="Hello")
+        irc_session.get_reply(client1, expect_timeout = True)
+
+
+    def test_notice_toomanytargets(self, irc_session):
+        """
+        user1 sends a NOTICE to five users, one more than the server
+        allows. Nobody gets the notice, and since NOTICE never gets
+        an error reply, user1 gets nothing back either.
+        """
+
+        clients = irc_session.connect_clients(6)
+        client1 = clients[0][1]
+
+        client1.send_cmd("NOTICE user2,user3,user4,user5,user6 :Hello")
+
+        for nick, client in clients:
+            irc_session.get_reply(client, expect_timeout = True)
+
+
+    def test_notice_notargets(self, irc_session):
+        """
+        A NOTICE whose target list is only commas names no one. NOTICE
+        never gets an error reply, so nothing comes back.
+        """
+
+        client1 = irc_session.connect_user("user1", "User One")
+
+        client1.send_cmd("NOTICE ,, :Hello")
+        irc_session.get_reply(client1, expect_timeout = True)